@@ -24,15 +24,16 @@ public:
 
 public:
 	virtual board::reward apply(board& b) const {
-		auto proto = entries().find(type());
-		if (proto != entries().end()) return proto->second->reinterpret(this).apply(b);
-		return -1;
-	}
-	virtual std::ostream& operator >>(std::ostream& out) const {
-		auto proto = entries().find(type());
-		if (proto != entries().end()) return proto->second->reinterpret(this) >> out;
-		return out << "??";
+		PROFILE_SCOPE(profile::apply);
+		return dispatch(b);
 	}
+	virtual std::ostream& operator >>(std::ostream& out) const;
+
+	/**
+	 * apply the action to a board (or a bitboard) by decoding its type with a compile-time switch,
+	 * i.e., without any prototype lookup, virtual call, or object re-construction
+	 */
+	template<typename state> board::reward dispatch(state& b) const;
 	virtual std::istream& operator <<(std::istream& in) {
 		auto state = in.rdstate();
 		for (auto proto = entries().begin(); proto != entries().end(); proto++) {
@@ -124,3 +125,20 @@ protected:
 	action& reinterpret(const action* a) const { return *new (const_cast<action*>(a)) place(*a); }
 	static __attribute__((constructor)) void init() { entries()[type_flag('p')] = new place; }
 };
+
+template<typename state>
+inline board::reward action::dispatch(state& b) const {
+	switch (type()) {
+	case slide::type: return b.slide(event());
+	case place::type: return b.place(event() & 0x0f, (event() >> 4) & 0x0f, (event() >> 8) & 0x0f);
+	default:          return -1;
+	}
+}
+
+inline std::ostream& action::operator >>(std::ostream& out) const {
+	switch (type()) {
+	case slide::type: return action::slide(*this) >> out;
+	case place::type: return action::place(*this) >> out;
+	default:          return out << "??";
+	}
+}
@@ -12,12 +12,32 @@
 #include <random>
 #include <sstream>
 #include <map>
+#include <unordered_map>
+#include <mutex>
 #include <type_traits>
 #include <algorithm>
 #include <fstream>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "board.h"
 #include "action.h"
 #include "weight.h"
+#include "ntuple.h"
+#include "bitboard.h"
+#include "transposition.h"
+#include "checkpoint.h"
+#include "arena.h"
+#include "prng.h"
+#include "threadpool.h"
+#include "timer.h"
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 class agent {
 public:
@@ -54,70 +74,498 @@ protected:
 
 /**
  * base agent for agents with randomness
+ * the generator is selected by rng=xoshiro256|pcg32|splitmix, and seeded by seed=
+ * agents of the same seed with different stream= draw from independent streams
+ *
+ * when notified with episode=<index>, as threes.cpp does before every episode, the generator is reseeded with
+ * the seed derived from the seed, the kind of the agent (slider or placer), and the index, on the same stream;
+ * so an episode does not depend on the previous ones nor on the thread or the process playing it,
+ * and a slider and a placer of the same seed do not draw the same numbers
  */
 class random_agent : public agent {
 public:
-	random_agent(const std::string& args = "") : agent(args) {
-		if (meta.find("seed") != meta.end())
-			engine.seed(int(meta["seed"]));
+	random_agent(const std::string& args = "", unsigned who = action::slide::type) : agent(args), who(who),
+		engine(meta.find("rng") != meta.end() ? std::string(meta["rng"]) : "xoshiro256") {
+		uint64_t seed = meta.find("seed") != meta.end() ? uint64_t(meta["seed"]) : 0;
+		uint64_t stream = meta.find("stream") != meta.end() ? uint64_t(meta["stream"]) : 0;
+		engine.seed(seed, stream);
 	}
 	virtual ~random_agent() {}
 
+	virtual void notify(const std::string& msg) {
+		agent::notify(msg);
+		if (msg.compare(0, 8, "episode=") != 0) return;
+		uint64_t seed = meta.find("seed") != meta.end() ? uint64_t(meta["seed"]) : 0;
+		uint64_t stream = meta.find("stream") != meta.end() ? uint64_t(meta["stream"]) : 0;
+		engine.seed(splitmix(splitmix(seed, who)(), uint64_t(meta["episode"]) + 1)(), stream);
+	}
+
 protected:
-	std::default_random_engine engine;
+	/**
+	 * a uniformly random integer in [0, n)
+	 */
+	unsigned uniform(unsigned n) { return engine.below(n); }
+
+protected:
+	unsigned who; // the kind of the agent, i.e., action::slide::type or action::place::type
+	prng engine;
 };
 
 /**
  * base agent for agents with weight tables and a learning rate
+ * an evaluation-only agent (alpha=0) maps the loaded weight file read-only, unless mmap=0 is given
+ *
+ * the network may have multiple stages, selected by the largest tile of a board, e.g., stages=192,768 for
+ * the boards without 192-tiles, those with 192-tiles but without 768-tiles, and those with 768-tiles;
+ * each stage has its own tables of the n-tuple patterns, and all tables are stored in a single block
+ * where the tables of a stage are contiguous
+ *
+ * the agents of the same options, e.g., the sliders of different threads (--threads), share one network,
+ * which is loaded by the first of them, and saved by the same one when it is destroyed;
+ * the agents which share a network may learn concurrently without locks (Hogwild), i.e., an update may be lost
+ * when two threads update the same weight at the same time, but a weight is never torn
+ *
+ * the weights are stored as float, or in 16 bits with precision=int16 (fixed point with a scale) or precision=bf16;
+ * an evaluation-only agent evaluates the 16-bit tables directly, and a learning agent always learns in float,
+ * in which case the precision only applies to the saved file
+ *
+ * a learning agent with save= and checkpoint=<episodes> also saves the network in the background every few episodes
+ * of all agents of the network, in float, as a best-effort snapshot taken while the agents continue, see checkpoint;
+ * with delta=1, only the pages changed since the previous snapshot are appended to a separate file (path.delta),
+ * whose records are applied in order when the weight file is loaded
+ *
+ * the block of the tables, either allocated or read from a file, is taken from an arena, where each table is aligned
+ * to cache lines, i.e., the tables read from a file are copied out of the file image; for large networks, pages=thp
+ * or pages=hugetlb backs the block by huge pages to reduce the TLB misses of the lookups, and numa=interleave
+ * spreads its pages over the NUMA nodes, see arena for details;
+ * an evaluation-only agent maps the weight file instead unless mmap=0 is given, whose pages are not affected
+ *
+ * a weight file is formatted as
+ * (magic "TCGW":4-byte) (version:4-byte) (type:4-byte) (scale:4-byte float)
+ * (#stage:4-byte) (thresholds of stages:4-byte each) (#table:4-byte)
+ * followed by a 64-bit size and the raw values per table, in the order of stages, and 8 bytes of padding,
+ * where type is 0 for float, 1 for int16, and 2 for bf16;
+ * version 1 has neither type nor scale, i.e., float, and a file without the magic is a single-stage network
+ * of float, i.e., the 32-bit count followed by the tables
  */
 class weight_agent : public agent {
 public:
-	weight_agent(const std::string& args = "") : agent(args), alpha(0) {
-		if (meta.find("init") != meta.end())
-			init_weights(meta["init"]);
-		if (meta.find("load") != meta.end())
-			load_weights(meta["load"]);
+	weight_agent(const std::string& args = "") : agent(args), alpha(0), form(fp32), scale(1),
+		memory(meta.find("pages") != meta.end() ? std::string(meta["pages"]) : "heap",
+		       meta.find("numa") != meta.end() ? std::string(meta["numa"]) : "local"), owner(false) {
+		if (meta.find("tuple") != meta.end())
+			tuples = ntuple(meta["tuple"]);
 		if (meta.find("alpha") != meta.end())
 			alpha = float(meta["alpha"]);
+
+		static std::mutex lock;
+		static std::map<std::string, std::weak_ptr<network>> networks;
+		std::lock_guard<std::mutex> guard(lock);
+		std::weak_ptr<network>& entry = networks[options()];
+		if ((share = entry.lock())) {
+			net = share->net;
+			net16 = share->net16;
+			netbf = share->netbf;
+			thresholds = share->thresholds;
+			form = share->form;
+			scale = share->scale;
+		} else {
+			if (meta.find("stages") != meta.end())
+				init_stages(meta["stages"]);
+			if (meta.find("init") != meta.end())
+				init_weights(meta["init"]);
+			if (meta.find("load") != meta.end())
+				load_weights(meta["load"]);
+			if (alpha) convert(fp32);
+			else if (meta.find("precision") != meta.end()) convert(precision(meta["precision"]));
+			if (weighted() && !match())
+				throw std::invalid_argument("weight tables do not match the n-tuple patterns");
+			entry = share = std::make_shared<network>(network{ net, net16, netbf, thresholds, form, scale });
+			owner = true;
+			if (alpha && meta.find("save") != meta.end() && meta.find("checkpoint") != meta.end()) {
+				bool delta = meta.find("delta") != meta.end() && int(meta["delta"]);
+				share->saver.reset(new checkpoint(meta["save"], layout(), size_t(meta["checkpoint"]), delta));
+			}
+		}
 	}
 	virtual ~weight_agent() {
-		if (meta.find("save") != meta.end())
+		if (owner && share->saver) share->saver->close();
+		if (owner && meta.find("save") != meta.end())
 			save_weights(meta["save"]);
 	}
 
+	/**
+	 * count an episode for the periodic checkpoints, which are shared by the agents of the network
+	 */
+	virtual void close_episode(const std::string& flag = "") {
+		if (share->saver) share->saver->tick();
+	}
+
 protected:
+	enum type { fp32 = 0, int16 = 1, bf16 = 2 };
+
+	static type precision(const std::string& name) {
+		if (name == "float") return fp32;
+		if (name == "int16") return int16;
+		if (name == "bf16") return bf16;
+		throw std::invalid_argument("unknown weight precision: " + name);
+	}
+
+	virtual void init_stages(const std::string& info) {
+		std::string res = info; // comma-separated tiles, e.g., "192,768"
+		for (char& ch : res)
+			if (!std::isdigit(ch)) ch = ' ';
+		std::stringstream in(res);
+		thresholds.clear();
+		for (unsigned tile; in >> tile; thresholds.push_back(board::ttoi(tile)));
+		std::sort(thresholds.begin(), thresholds.end());
+	}
+	/**
+	 * allocate the float tables of all stages in a single zeroed block
+	 */
 	virtual void init_weights(const std::string& info) {
-		std::string res = info; // comma-separated sizes, e.g., "65536,65536"
+		std::string res = info; // comma-separated sizes of a stage, e.g., "65536,65536"
 		for (char& ch : res)
 			if (!std::isdigit(ch)) ch = ' ';
 		std::stringstream in(res);
-		for (size_t size; in >> size; net.emplace_back(size));
+		std::vector<size_t> sizes, all;
+		for (size_t size; in >> size; sizes.push_back(size));
+		for (size_t s = 0; s < stages(); s++) all.insert(all.end(), sizes.begin(), sizes.end());
+		net = allocate<float>(all);
+		form = fp32;
 	}
 	virtual void load_weights(const std::string& path) {
-		std::ifstream in(path, std::ios::in | std::ios::binary);
+		bool mapping = meta.find("mmap") == meta.end() || int(meta["mmap"]);
+		bool delta = ::access((path + ".delta").c_str(), F_OK) == 0;
+		if (alpha == 0 && mapping && !delta && map_weights(path)) return;
+		std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
 		if (!in.is_open()) std::exit(-1);
-		uint32_t size;
-		in.read(reinterpret_cast<char*>(&size), sizeof(size));
-		net.resize(size);
-		for (weight& w : net) in >> w;
+		size_t len = in.tellg();
+		std::shared_ptr<char> block(new char[len], std::default_delete<char[]>());
+		in.seekg(0);
+		in.read(block.get(), len);
 		in.close();
+		if (!in) std::exit(-1);
+		if (delta) checkpoint::patch(path + ".delta", block.get(), len);
+		if (!parse_weights(block.get(), len, block)) std::exit(-1);
+		// the tables of the file are not aligned, so they are copied to the arena and the file image is released
+		net = relocate(net);
+		net16 = relocate(net16);
+		netbf = relocate(netbf);
+	}
+	/**
+	 * map a weight file read-only and view the tables in place, so that the pages are shared among processes
+	 * return false if the file cannot be mapped, and the tables should be read instead
+	 */
+	virtual bool map_weights(const std::string& path) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd == -1) return false;
+		struct stat st;
+		void* addr = MAP_FAILED;
+		if (::fstat(fd, &st) == 0 && st.st_size > 0)
+			addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (addr == MAP_FAILED) return false;
+		size_t len = st.st_size;
+		std::shared_ptr<void> owner(addr, [len](void* p) { ::munmap(p, len); });
+		return parse_weights(static_cast<char*>(addr), len, owner);
 	}
+	/**
+	 * view the tables of a weight file stored in memory, which is kept alive by owner
+	 * return false if the file is malformed
+	 */
+	bool parse_weights(char* base, size_t len, std::shared_ptr<void> owner) {
+		size_t off = 0;
+		auto get = [&](uint32_t& v) -> bool {
+			if (len - off < sizeof(v)) return false;
+			std::memcpy(&v, base + off, sizeof(v));
+			off += sizeof(v);
+			return true;
+		};
+		uint32_t num, version = 0, kind = fp32, bits, stage = 1;
+		float mul = 1;
+		std::vector<unsigned> cuts;
+		if (!get(num)) return false;
+		if (num == magic()) {
+			if (!get(version) || version < 1 || version > 2) return false;
+			if (version >= 2) {
+				if (!get(kind) || kind > bf16 || !get(bits)) return false;
+				std::memcpy(&mul, &bits, sizeof(mul));
+			}
+			if (!get(stage) || stage == 0) return false;
+			for (uint32_t t = 1, cut; t < stage; t++) {
+				if (!get(cut)) return false;
+				cuts.push_back(cut);
+			}
+			if (!get(num)) return false;
+		}
+		if (num % stage) return false;
+		bool ok = false;
+		switch (kind) {
+		case fp32: ok = view_tables(base, len, off, num, owner, net); break;
+		case int16: ok = view_tables(base, len, off, num, owner, net16); break;
+		case bf16: ok = view_tables(base, len, off, num, owner, netbf); break;
+		}
+		if (!ok) return false;
+		form = type(kind);
+		scale = mul;
+		thresholds.swap(cuts);
+		return true;
+	}
+	template<typename value_t>
+	static bool view_tables(char* base, size_t len, size_t off, uint32_t num, std::shared_ptr<void> owner,
+			std::vector<basic_weight<value_t>>& tables) {
+		std::vector<basic_weight<value_t>> view;
+		for (uint32_t i = 0; i < num; i++) {
+			uint64_t size;
+			if (len - off < sizeof(size)) return false;
+			std::memcpy(&size, base + off, sizeof(size));
+			off += sizeof(size);
+			if ((len - off) / sizeof(value_t) < size) return false;
+			view.emplace_back(reinterpret_cast<value_t*>(base + off), size, owner);
+			off += sizeof(value_t) * size;
+		}
+		tables.swap(view);
+		return true;
+	}
+	/**
+	 * the tables are written to a temporary file which then replaces the target,
+	 * so that a table mapped from the target remains valid while being written
+	 * the tables are saved in the given precision, or in their current precision by default
+	 */
 	virtual void save_weights(const std::string& path) {
-		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
-		if (!out.is_open()) std::exit(-1);
-		uint32_t size = net.size();
-		out.write(reinterpret_cast<char*>(&size), sizeof(size));
-		for (weight& w : net) out << w;
-		out.close();
+		if (meta.find("precision") != meta.end()) convert(precision(meta["precision"]));
+		if (!checkpoint::commit(path, layout())) std::exit(-1);
+		std::remove((path + ".delta").c_str());
+	}
+	/**
+	 * the image of the weight file, which views the tables in place
+	 */
+	image layout() const {
+		image file;
+		uint32_t bits;
+		std::memcpy(&bits, &scale, sizeof(bits));
+		file.append(magic());
+		file.append(uint32_t(2));
+		file.append(uint32_t(form));
+		file.append(bits);
+		file.append(uint32_t(stages()));
+		for (unsigned cut : thresholds) file.append(uint32_t(cut));
+		switch (form) {
+		case fp32: layout(file, net); break;
+		case int16: layout(file, net16); break;
+		case bf16: layout(file, netbf); break;
+		}
+		file.append(uint64_t(0));
+		return file;
+	}
+	template<typename value_t>
+	static void layout(image& file, const std::vector<basic_weight<value_t>>& tables) {
+		file.append(uint32_t(tables.size()));
+		for (const auto& w : tables) {
+			file.append(uint64_t(w.size()));
+			file.append(&w[0], sizeof(value_t) * w.size());
+		}
+	}
+
+	static uint32_t magic() { return 0x57474354u; } // "TCGW" in little endian
+
+	/**
+	 * the options which affect the values, i.e., all options except the random streams
+	 */
+	std::string options() const {
+		std::string res;
+		for (const auto& opt : meta)
+			if (opt.first != "seed" && opt.first != "stream") res += opt.first + "=" + opt.second.value + " ";
+		return res;
+	}
+
+	/**
+	 * allocate zeroed tables of the given sizes in a single block of the arena, where each table begins at a cache line
+	 * the block is padded so that the 16-bit tables can be gathered as 32-bit words
+	 */
+	template<typename value_t>
+	std::vector<basic_weight<value_t>> allocate(const std::vector<size_t>& sizes) const {
+		const size_t align = arena::line / sizeof(value_t);
+		size_t total = 2;
+		for (size_t size : sizes) total += (size + align - 1) / align * align;
+		std::shared_ptr<char> block = memory.allocate(total * sizeof(value_t));
+		std::vector<basic_weight<value_t>> tables;
+		value_t* it = reinterpret_cast<value_t*>(block.get());
+		for (size_t size : sizes) {
+			tables.emplace_back(it, size, block);
+			it += (size + align - 1) / align * align;
+		}
+		return tables;
+	}
+
+	/**
+	 * convert the tables to another precision, where the int16 scale maps the largest weight to 32767
+	 */
+	void convert(type to) {
+		if (to == form || !weighted()) return;
+		if (form != fp32) {
+			if (form == int16) net = cast<float>(net16, scale);
+			if (form == bf16) net = cast<float>(netbf, 1);
+			net16.clear();
+			netbf.clear();
+			form = fp32;
+			scale = 1;
+		}
+		if (to == int16) {
+			float max = 0;
+			for (const weight& w : net)
+				for (size_t i = 0; i < w.size(); i++) max = std::max(max, std::abs(w[i]));
+			scale = max > 0 ? max / 32767 : 1;
+			net16 = cast<int16_t>(net, 1 / scale);
+		}
+		if (to == bf16) netbf = cast<bfloat16>(net, 1);
+		if (to != fp32) net.clear();
+		form = to;
+	}
+	template<typename to_t, typename from_t>
+	std::vector<basic_weight<to_t>> cast(const std::vector<basic_weight<from_t>>& from, float mul) const {
+		std::vector<size_t> sizes;
+		for (const auto& w : from) sizes.push_back(w.size());
+		std::vector<basic_weight<to_t>> to = allocate<to_t>(sizes);
+		for (size_t t = 0; t < from.size(); t++)
+			for (size_t i = 0; i < from[t].size(); i++) assign(to[t][i], float(from[t][i]) * mul);
+		return to;
 	}
+	template<typename value_t>
+	std::vector<basic_weight<value_t>> relocate(const std::vector<basic_weight<value_t>>& from) const {
+		if (from.empty()) return {};
+		std::vector<size_t> sizes;
+		for (const auto& w : from) sizes.push_back(w.size());
+		std::vector<basic_weight<value_t>> to = allocate<value_t>(sizes);
+		for (size_t t = 0; t < from.size(); t++) std::memcpy(&to[t][0], &from[t][0], sizeof(value_t) * from[t].size());
+		return to;
+	}
+	static void assign(float& w, float v) { w = v; }
+	static void assign(bfloat16& w, float v) { w = v; }
+	static void assign(int16_t& w, float v) { w = int16_t(std::max(-32767.0f, std::min(32767.0f, std::round(v)))); }
 
 protected:
-	std::vector<weight> net;
-	float alpha;
-};
+	size_t stages() const { return thresholds.size() + 1; }
+	/**
+	 * the stage of a board, i.e., the number of thresholds reached by its largest tile
+	 */
+	size_t stage(const bitboard& b) const {
+		board::cell max = b.max_tile();
+		size_t s = 0;
+		for (unsigned cut : thresholds) s += max >= cut;
+		return s;
+	}
+	/**
+	 * the float tables of a stage, or of the stage of a board
+	 */
+	weight* tables(size_t s) { return &net[s * tuples.size()]; }
+	const weight* tables(size_t s) const { return &net[s * tuples.size()]; }
+	weight* tables(const bitboard& b) { return tables(stage(b)); }
+	const weight* tables(const bitboard& b) const { return tables(stage(b)); }
+
+	/**
+	 * whether the network is initialized or loaded
+	 */
+	bool weighted() const { return net.size() || net16.size() || netbf.size(); }
+
+	/**
+	 * check whether each stage has one table of matched size per pattern
+	 */
+	bool match() const {
+		switch (form) {
+		case int16: return match(net16);
+		case bf16: return match(netbf);
+		default: return match(net);
+		}
+	}
+	template<typename value_t>
+	bool match(const std::vector<basic_weight<value_t>>& tables) const {
+		if (tables.size() != stages() * tuples.size()) return false;
+		for (size_t s = 0; s < stages(); s++)
+			if (!tuples.match(&tables[s * tuples.size()])) return false;
+		return true;
+	}
 
+	/**
+	 * estimate the value of a board with the n-tuple network of its stage
+	 */
+	float estimate(const bitboard& b) const {
+		uint32_t idx[ntuple::max_patterns * 8];
+		tuples.indices(b, idx);
+		return estimate(idx, stage(b));
+	}
+	/**
+	 * estimate the values of a batch of boards, where the features of several boards are extracted and prefetched
+	 * before any of them is accumulated, so that the cache misses of the lookups overlap
+	 */
+	void estimate(const bitboard* b, size_t num, float* value) const {
+		enum { batch = 8 };
+		uint32_t idx[batch][ntuple::max_patterns * 8];
+		size_t s[batch];
+		for (size_t i = 0; i < num; i += batch) {
+			size_t len = std::min<size_t>(batch, num - i);
+			for (size_t k = 0; k < len; k++) {
+				tuples.indices(b[i + k], idx[k]);
+				s[k] = stage(b[i + k]);
+				prefetch(idx[k], s[k]);
+			}
+			for (size_t k = 0; k < len; k++) value[i + k] = estimate(idx[k], s[k]);
+		}
+	}
+	/**
+	 * prefetch the weights of the extracted features of a board in the given stage
+	 */
+	void prefetch(const uint32_t* idx, size_t s) const {
+		switch (form) {
+		case int16: tuples.prefetch(idx, &net16[s * tuples.size()]); break;
+		case bf16: tuples.prefetch(idx, &netbf[s * tuples.size()]); break;
+		default: tuples.prefetch(idx, tables(s)); break;
+		}
+	}
+	/**
+	 * estimate the value of the extracted features of a board in the given stage
+	 */
+	float estimate(const uint32_t* idx, size_t s) const {
+		switch (form) {
+		case int16: return tuples.estimate(idx, &net16[s * tuples.size()]) * scale;
+		case bf16: return tuples.estimate(idx, &netbf[s * tuples.size()]);
+		default: return tuples.estimate(idx, tables(s));
+		}
+	}
+	/**
+	 * adjust the value of a board by u, i.e., add u to all its feature weights
+	 */
+	void update(const bitboard& b, float u) {
+		tuples.update(b, tables(b), u);
+	}
 
+protected:
+	std::vector<weight> net; // the float tables of all stages
+	std::vector<basic_weight<int16_t>> net16; // the fixed-point tables, if the precision is int16
+	std::vector<basic_weight<bfloat16>> netbf; // the bfloat16 tables, if the precision is bf16
+	std::vector<unsigned> thresholds; // the tile indices which begin the stages after the first one
+	ntuple tuples;
+	float alpha;
+	type form; // the precision of the tables
+	float scale; // the value of one unit of the fixed-point tables
+	arena memory; // the allocator of the blocks of tables
 
+	/**
+	 * the network shared by the agents of the same options, whose tables are views of the same blocks
+	 */
+	struct network {
+		std::vector<weight> net;
+		std::vector<basic_weight<int16_t>> net16;
+		std::vector<basic_weight<bfloat16>> netbf;
+		std::vector<unsigned> thresholds;
+		type form;
+		float scale;
+		std::shared_ptr<checkpoint> saver; // the periodic checkpoints of the network in training, if any
+	};
+	std::shared_ptr<network> share;
+	bool owner; // whether the network is loaded by this agent, which then saves it
+};
 
 /**
  * default random environment, i.e., placer
@@ -125,36 +573,81 @@ protected:
  */
 class random_placer : public random_agent {
 public:
-	random_placer(const std::string& args = "") : random_agent("name=slide role=slider " + args) {
-		spaces[0] = { 12, 13, 14, 15 };
-		spaces[1] = { 0, 4, 8, 12 };
-		spaces[2] = { 0, 1, 2, 3};
-		spaces[3] = { 3, 7, 11, 15 };
-		spaces[4] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
-	}
+	random_placer(const std::string& args = "") : random_agent("name=slide role=slider " + args, action::place::type) {}
 
+	/**
+	 * place a tile on a uniformly random empty cell of the legal edge, without any allocation
+	 * the tile and the hint are drawn from the bag as if the bag were shuffled, i.e.,
+	 * the tile is the hint if there is one, and the next hint is a uniformly random tile of the bag
+	 */
 	virtual action take_action(const board& after) {
-		std::vector<int> space = spaces[after.last()];
-		std::shuffle(space.begin(), space.end(), engine);
-		for (int pos : space) {
-			if (after(pos) != 0) continue;
+		unsigned space = bitboard(after).empty() & space_mask(after.last());
+		if (space == 0) return action();
+		unsigned pos = select(space, uniform(popcount(space)));
 
-			int bag[3], num = 0;
-			for (board::cell t = 1; t <= 3; t++)
-				for (size_t i = 0; i < after.bag(t); i++)
-					bag[num++] = t;
-			std::shuffle(bag, bag + num, engine);
+		unsigned bag = (after.info() >> 8) & 0xfffu;
+		board::cell tile = after.hint();
+		if (tile == 0) {
+			tile = draw(bag);
+			bag -= 1u << (4 * (tile - 1));
+		}
+		board::cell hint = draw(bag);
 
-			board::cell tile = after.hint() ?: bag[--num];
-			board::cell hint = bag[--num];
+		return action::place(pos, tile, hint);
+	}
 
-			return action::place(pos, tile, hint);
-		}
-		return action();
+	/**
+	 * the mask of cells where the next tile may be placed, given the last action
+	 */
+	static unsigned space_mask(unsigned last) {
+		static const unsigned mask[5] = { 0xf000u, 0x1111u, 0x000fu, 0x8888u, 0xffffu };
+		return mask[last < 5 ? last : 4];
 	}
 
 private:
-	std::vector<int> spaces[5];
+	/**
+	 * draw a tile from the bag, where the bag is the packed counts of 1-, 2-, and 3-tiles (4-bit each)
+	 */
+	board::cell draw(unsigned bag) {
+		const counts& c = counts::find()[bag];
+		unsigned r = uniform(c.total);
+		return r < c.one ? 1 : r < c.two ? 2 : 3;
+	}
+
+	static unsigned popcount(unsigned x) { return __builtin_popcount(x); }
+
+	/**
+	 * the position of the (k)-th (0-indexed) set bit of a nonzero mask
+	 */
+	static unsigned select(unsigned mask, unsigned k) {
+#if defined(__BMI2__)
+		return __builtin_ctz(_pdep_u32(1u << k, mask));
+#else
+		while (k--) mask &= mask - 1;
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	/**
+	 * the cumulative counts of a packed bag, i.e., #1-tile, #1-tile + #2-tile, and the total
+	 */
+	struct counts {
+		uint8_t one, two, total;
+
+		static const counts* find() {
+			static const struct table {
+				counts bag[4096];
+				table() {
+					for (unsigned i = 0; i < 4096; i++) {
+						bag[i].one = i & 0x0fu;
+						bag[i].two = bag[i].one + ((i >> 4) & 0x0fu);
+						bag[i].total = bag[i].two + ((i >> 8) & 0x0fu);
+					}
+				}
+			} table;
+			return table.bag;
+		}
+	};
 };
 
 /**
@@ -167,10 +660,10 @@ public:
 		opcode({ 0, 1, 2, 3 }) {}
 
 	virtual action take_action(const board& before) {
-		std::shuffle(opcode.begin(), opcode.end(), engine);
+		engine.shuffle(opcode.begin(), opcode.end());
+		unsigned legal = before.moves();
 		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
-			if (reward != -1) return action::slide(op);
+			if (legal & (1u << op)) return action::slide(op);
 		}
 		return action();
 	}
@@ -188,10 +681,13 @@ public:
 	random_slider_1(const std::string& args = "") : random_agent("name=slide role=slider " + args),
 		opcode({ 0, 1, 2, 3 }) {}
 
-	action take_action(const board& before) {
+	action take_action(const board& state) {
 		int max_op = -1, max = -1;
+		std::array<bitboard, 4> after;
+		std::array<board::reward, 4> rewards;
+		state.afterstates(after, rewards);
 		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
+			board::reward reward = rewards[op];
 			if (reward > max){
 				max_op = op;
 				max = reward;
@@ -209,19 +705,21 @@ class random_slider_2 : public random_agent {
 	random_slider_2(const std::string& args = "") : random_agent("name=slide role=slider " + args),
 		opcode({ 0, 1, 2, 3 }) {}
 
-	action take_action(const board& before) {
+	action take_action(const board& state) {
 		int max_op = -1, max = -1;
+		std::array<bitboard, 4> after, inside_after;
+		std::array<board::reward, 4> rewards, inside_rewards;
+		state.afterstates(after, rewards);
 
 		for (int op : opcode) {
-			auto tmp = before;
-			board::reward outside_reward = tmp.slide(op);
+			auto& tmp = after[op];
+			board::reward outside_reward = rewards[op];
 			
 			//board::reward placer_reward = placer.take_action(tmp).apply(tmp);
 
+			tmp.afterstates(inside_after, inside_rewards);
 			for (int inside_op : opcode){
-				auto inside_tmp = tmp;
-				
-				board::reward inside_reward = inside_tmp.slide(inside_op);
+				board::reward inside_reward = inside_rewards[inside_op];
 				if(inside_reward + outside_reward > max){
 					max = inside_reward + outside_reward;
 					max_op = op;
@@ -235,3 +733,536 @@ private:
 	random_placer placer;
 
 };
+
+/**
+ * expectimax player, i.e., slider
+ * maximize the expected rewards of the next 'depth' slides
+ *
+ * the chance nodes average over every placement the random placer may take,
+ * i.e., each empty cell of spaces[last] with the hint tile, followed by each
+ * possible next hint weighted by its count in the bag
+ *
+ * the leaves are estimated by the n-tuple network if it is initialized or loaded, or worth nothing otherwise
+ *
+ * the transposition table is shared by the agents of the same options on all threads,
+ * i.e., those differing only in seed= or stream=
+ *
+ * with parallel=move, each decision is split on a pool of threads, where the tasks are the chance branches
+ * (position and hint) of all root slides, and the results are merged in the same order as the serial search,
+ * so the decisions do not depend on the number of threads; by default (parallel=episode), a decision
+ * is searched on the calling thread, and the parallelism is left to the episodes (--threads)
+ * the pool is shared by the agents of all threads, so with --threads, workers= is the total of the pool threads,
+ * and the decisions of different threads take turns on the pool
+ *
+ * with budget=<time>, e.g., budget=500us, each decision is searched by iterative deepening up to depth,
+ * and the deepest result searched within the time is taken; with per=episode, the budget is for a whole episode,
+ * and each decision takes an even share of the remaining budget; the best slide of each complete iteration is stored
+ * in the table along with the root board, so a later search of the same board tries that slide first
+ *
+ * with book=<path>, the values of the root afterstates of the first few slides of each episode are also kept
+ * in a table mapped from the file, which persists across runs and is shared by concurrent processes;
+ * they are consulted before the search by copying them into the transposition table, so the decisions are the same
+ * the file is tied to the network, i.e., the options of the weights and the size and time of the loaded file,
+ * and it is reinitialized if they change; its size is fixed, where a bucket keeps its deepest and most recent entries
+ *
+ * options: depth=<slides to look ahead, 2 by default, or at most 32 with a budget> tt=<transposition table size in MB>
+ *          parallel=<episode|move> workers=<threads of the pool for parallel=move>
+ *          budget=<time per move, e.g., 500us, 2ms, 1s> per=<move|episode>
+ *          book=<path of the persistent table> booksize=<its size in MB> opening=<slides per episode kept in it>
+ */
+class expectimax_slider : public weight_agent {
+public:
+	expectimax_slider(const std::string& args = "") : weight_agent("name=expectimax role=slider depth=0 tt=16 per=move booksize=64 opening=20 " + args),
+		depth(int(meta["depth"])), cache(transposition::shared(size_t(meta["tt"]) << 20, options())),
+		budget(meta.find("budget") != meta.end() ? duration(meta["budget"]) : 0), per_episode(false),
+		deadline(0), timeout(false), remain(0), slides(0), length(200), opening(size_t(meta["opening"])) {
+		if (depth == 0) depth = budget ? 32 : 2;
+		if (meta.find("book") != meta.end())
+			book = transposition::persistent(meta["book"], size_t(meta["booksize"]) << 20, network());
+		std::string mode = meta.find("parallel") != meta.end() ? std::string(meta["parallel"]) : "episode";
+		if (mode == "move") {
+			size_t threads = meta.find("workers") != meta.end() ? size_t(meta["workers"]) : std::thread::hardware_concurrency();
+			pool = threadpool::shared(threads);
+		} else if (mode != "episode") {
+			throw std::invalid_argument("unknown parallel mode: " + mode);
+		}
+		std::string per = meta["per"];
+		if (per == "episode") per_episode = true;
+		else if (per != "move") throw std::invalid_argument("unknown budget period: " + per);
+	}
+
+	virtual void open_episode(const std::string& flag = "") {
+		remain = budget;
+		slides = 0;
+	}
+	virtual void close_episode(const std::string& flag = "") {
+		length = (length * 3 + slides) / 4;
+	}
+
+	virtual action take_action(const board& state) {
+		std::array<bitboard, 4> after;
+		std::array<board::reward, 4> reward;
+		std::array<float, 4> expected;
+		state.afterstates(after, reward);
+		PROFILE_COUNT(profile::move, 1);
+		PROFILE_COUNT(profile::node, 1);
+		slides++;
+		if (budget == 0) {
+			expand(after, reward, expected, depth, { 0, 1, 2, 3 });
+			return best_slide(reward, expected, 0b1111);
+		}
+
+		/*
+		 * deepen the search until the budget of this move is used up, and the previous best slide is searched first;
+		 * before the first iteration, the previous best is the best slide stored in the table (or the book) by an earlier
+		 * search of this board; if the time is up within an iteration, its complete slides are still compared if they
+		 * include the previous best, otherwise the result of the previous iteration is taken
+		 */
+		uint64_t start = timer::now();
+		deadline = start + allowance();
+		timeout = false;
+		bitboard root = state;
+		bool opened = book && slides <= opening;
+		int best_op = cache->best(root);
+		if (best_op == -1 && opened) best_op = book->best(root);
+		if (best_op != -1 && reward[best_op] == -1) best_op = -1;
+		unsigned legal = 0;
+		for (int op = 0; op < 4; op++) if (reward[op] != -1) legal |= 1u << op;
+		for (unsigned d = 1; d <= depth && !timeout; d++) {
+			std::array<int, 4> order = { 0, 1, 2, 3 };
+			if (best_op != -1) std::swap(order[0], order[best_op]), std::sort(order.begin() + 1, order.end());
+			unsigned done = expand(after, reward, expected, d, order);
+			if (best_op == -1 || (done & (1u << best_op))) {
+				int op = best_slide(reward, expected, done).event();
+				if (done) best_op = op;
+			}
+			if (done != legal || !done) continue;
+			cache->store(root, d, reward[best_op] + expected[best_op], best_op);
+			if (opened) book->store(root, d, reward[best_op] + expected[best_op], best_op);
+		}
+		if (per_episode) remain -= std::min<uint64_t>(remain, timer::now() - start);
+		deadline = 0;
+		timeout = false;
+		return best_op == -1 ? action() : action::slide(best_op);
+	}
+
+protected:
+	/**
+	 * the expected values of the legal root afterstates with depth (d), searched in the given order of slides
+	 * return the mask of legal slides whose values are complete, i.e., all of them unless the time is up
+	 */
+	unsigned expand(const std::array<bitboard, 4>& after, const std::array<board::reward, 4>& reward,
+			std::array<float, 4>& expected, unsigned d, const std::array<int, 4>& order) {
+		unsigned done = 0;
+		bool opened = book && d > 1 && slides <= opening;
+		for (int op = 0; op < 4 && opened; op++) {
+			float value;
+			if (reward[op] != -1 && book->find(after[op], d - 1, value)) cache->store(after[op], d - 1, value);
+		}
+		if (pool && d > 1) {
+			split(after, reward, expected, d);
+			for (int op = 0; op < 4 && !timeout; op++)
+				if (reward[op] != -1) done |= 1u << op;
+		} else {
+			for (int op : order) {
+				if (reward[op] == -1) continue;
+				expected[op] = expect(after[op], d - 1);
+				if (timeout) break;
+				done |= 1u << op;
+			}
+		}
+		for (int op = 0; op < 4 && opened; op++)
+			if (done & (1u << op)) book->store(after[op], d - 1, expected[op]);
+		return done;
+	}
+
+	/**
+	 * the tag of the persistent table, i.e., the options which determine the values of the network,
+	 * with the size and the modification time of the loaded weight file
+	 */
+	std::string network() const {
+		std::string res;
+		for (const char* key : { "name", "tuple", "init", "load", "stages", "precision" }) {
+			auto it = meta.find(key);
+			if (it != meta.end()) res += std::string(key) + "=" + it->second.value + " ";
+		}
+		struct stat st;
+		if (meta.find("load") != meta.end() && ::stat(meta.at("load").value.c_str(), &st) == 0)
+			res += "file=" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtime);
+		return res;
+	}
+
+	/**
+	 * the slide with the maximal reward plus expected value among the given mask of slides
+	 */
+	action best_slide(const std::array<board::reward, 4>& reward, const std::array<float, 4>& expected, unsigned mask) {
+		int best_op = -1;
+		float best = 0;
+		for (int op = 0; op < 4; op++) {
+			if (reward[op] == -1 || !(mask & (1u << op))) continue;
+			PROFILE_COUNT(profile::child, 1);
+			float value = reward[op] + expected[op];
+			if (best_op == -1 || value > best) {
+				best_op = op;
+				best = value;
+			}
+		}
+		return best_op == -1 ? action() : action::slide(best_op);
+	}
+
+	/**
+	 * the time allowed for this move, i.e., the budget per move, or an even share of the remaining budget
+	 * of this episode over the remaining slides, estimated from the lengths of the previous episodes
+	 */
+	uint64_t allowance() const {
+		if (!per_episode) return budget;
+		uint64_t left = std::max<uint64_t>(length > slides ? length - slides : 0, 10);
+		return remain / left;
+	}
+
+	/**
+	 * parse a duration into nanoseconds, e.g., "500us", "2ms", "1s", or a number of microseconds
+	 */
+	static uint64_t duration(const std::string& str) {
+		size_t end = 0;
+		double num = std::stod(str, &end);
+		std::string unit = str.substr(end);
+		if (unit == "ns") return num;
+		if (unit == "us" || unit == "") return num * 1e3;
+		if (unit == "ms") return num * 1e6;
+		if (unit == "s") return num * 1e9;
+		throw std::invalid_argument("unknown time unit: " + str);
+	}
+
+protected:
+	/**
+	 * the heuristic value of a leaf afterstate
+	 */
+	virtual float evaluate(const bitboard& after) {
+		return weighted() ? estimate(after) : 0;
+	}
+	/**
+	 * the heuristic values of a batch of leaf afterstates
+	 */
+	virtual void evaluate(const bitboard* after, size_t num, float* value) {
+		if (weighted()) estimate(after, num, value);
+		else std::fill(value, value + num, 0.0f);
+	}
+
+	/**
+	 * the expected value of an afterstate over all possible placements
+	 */
+	float expect(const bitboard& after, unsigned depth) {
+		if (depth == 0 || after.hint() == 0) return evaluate(after);
+		if (timeout) return 0;
+		float value;
+		if (cache->find(after, depth, value)) return value;
+		PROFILE_COUNT(profile::chance, 1);
+
+		unsigned space = after.empty() & random_placer::space_mask(after.last());
+		float sum = 0;
+		unsigned num = 0;
+		if (depth == 1) {
+			frontier(after, space, sum, num);
+		} else {
+			for (; space; space &= space - 1) {
+				unsigned pos = __builtin_ctz(space);
+				for (board::cell hint = 1; hint <= 3; hint++) {
+					unsigned count = after.bag(hint);
+					if (count == 0) continue;
+					bitboard before = after;
+					before.place(pos, after.hint(), hint);
+					sum += count * search(before, depth);
+					num += count;
+				}
+			}
+		}
+		if (timeout) return 0;
+		value = num ? sum / num : evaluate(after);
+		cache->store(after, depth, value);
+		return value;
+	}
+
+	/**
+	 * accumulate the placements of an afterstate at depth 1, i.e., the same as search(before, 1) for each placement,
+	 * where the leaf afterstates of all placements are collected and evaluated as a single batch
+	 */
+	void frontier(const bitboard& after, unsigned space, float& sum, unsigned& num) {
+		if (deadline && timer::now() > deadline) timeout = true;
+		if (timeout) return;
+		std::array<unsigned, 48> count; // the placements, at most 16 positions with 3 hints
+		std::array<bitboard, 48 * 4> leaf; // the legal afterstates of all placements
+		std::array<float, 48 * 4> value;
+		std::array<board::reward, 48 * 4> reward;
+		std::array<unsigned, 48 * 4> owner; // the placement of each afterstate
+		size_t children = 0, leaves = 0;
+		for (; space; space &= space - 1) {
+			unsigned pos = __builtin_ctz(space);
+			for (board::cell hint = 1; hint <= 3; hint++) {
+				if (after.bag(hint) == 0) continue;
+				bitboard before = after;
+				before.place(pos, after.hint(), hint);
+				std::array<bitboard, 4> next;
+				std::array<board::reward, 4> gain;
+				before.afterstates(next, gain);
+				PROFILE_COUNT(profile::node, 1);
+				for (int op = 0; op < 4; op++) {
+					if (gain[op] == -1) continue;
+					PROFILE_COUNT(profile::child, 1);
+					leaf[leaves] = next[op];
+					reward[leaves] = gain[op];
+					owner[leaves++] = children;
+				}
+				count[children++] = after.bag(hint);
+			}
+		}
+		evaluate(leaf.data(), leaves, value.data());
+		std::array<float, 48> best = {}; // the value of each placement, or zero if it has no legal slide
+		std::array<bool, 48> moved = {};
+		for (size_t i = 0; i < leaves; i++) {
+			float v = reward[i] + value[i];
+			if (!moved[owner[i]] || v > best[owner[i]]) best[owner[i]] = v;
+			moved[owner[i]] = true;
+		}
+		for (size_t c = 0; c < children; c++) {
+			sum += count[c] * best[c];
+			num += count[c];
+		}
+	}
+
+	/**
+	 * the maximal value among all legal slides of a board, which may be negative
+	 * a terminal board, i.e., one without any legal slide, is worth nothing
+	 */
+	float search(const bitboard& before, unsigned depth) {
+		if (deadline && timer::now() > deadline) timeout = true;
+		if (timeout) return 0;
+		std::array<bitboard, 4> after;
+		std::array<board::reward, 4> reward;
+		before.afterstates(after, reward);
+		float best = 0;
+		bool moved = false;
+		PROFILE_COUNT(profile::node, 1);
+		for (int op = 0; op < 4; op++) {
+			if (reward[op] == -1) continue;
+			PROFILE_COUNT(profile::child, 1);
+			float value = reward[op] + expect(after[op], depth - 1);
+			if (!moved || value > best) best = value;
+			moved = true;
+		}
+		return best;
+	}
+
+	/**
+	 * the expected values of the legal root afterstates, where the chance branches are searched on the pool,
+	 * the same as expect(after[op], d - 1) for each legal slide (op)
+	 */
+	void split(const std::array<bitboard, 4>& after, const std::array<board::reward, 4>& reward, std::array<float, 4>& expected, unsigned d) {
+		branches.clear();
+		std::array<bool, 4> known = {};
+		for (int op = 0; op < 4; op++) {
+			if (reward[op] == -1) continue;
+			if (after[op].hint() == 0 || cache->find(after[op], d - 1, expected[op])) {
+				if (after[op].hint() == 0) expected[op] = evaluate(after[op]);
+				known[op] = true;
+				continue;
+			}
+			PROFILE_COUNT(profile::chance, 1);
+			unsigned space = after[op].empty() & random_placer::space_mask(after[op].last());
+			for (; space; space &= space - 1) {
+				unsigned pos = __builtin_ctz(space);
+				for (board::cell hint = 1; hint <= 3; hint++) {
+					unsigned count = after[op].bag(hint);
+					if (count == 0) continue;
+					bitboard before = after[op];
+					before.place(pos, after[op].hint(), hint);
+					branches.push_back({ unsigned(op), count, before, 0 });
+				}
+			}
+		}
+
+		pool->run(branches.size(), [this, d](size_t i) {
+			branches[i].value = search(branches[i].before, d - 1);
+		});
+		if (timeout) return;
+
+		std::array<float, 4> sum = {};
+		std::array<unsigned, 4> num = {};
+		for (const branch& br : branches) {
+			sum[br.op] += br.count * br.value;
+			num[br.op] += br.count;
+		}
+		for (int op = 0; op < 4; op++) {
+			if (reward[op] == -1 || known[op]) continue;
+			expected[op] = num[op] ? sum[op] / num[op] : evaluate(after[op]);
+			cache->store(after[op], d - 1, expected[op]);
+		}
+	}
+
+protected:
+	unsigned depth;
+	std::shared_ptr<transposition> cache;
+
+	struct branch {
+		unsigned op, count;
+		bitboard before;
+		float value;
+	};
+	std::shared_ptr<threadpool> pool; // the pool of parallel=move shared by the agents of all threads, or null otherwise
+	std::vector<branch> branches;
+
+	uint64_t budget; // the time budget in nanoseconds per move (or per episode), or zero for a fixed depth
+	bool per_episode;
+	uint64_t deadline; // the time to stop the current search, or zero if unlimited
+	std::atomic<bool> timeout; // whether the current search is stopped
+	uint64_t remain; // the remaining budget of the current episode
+	size_t slides; // the slides of the current episode
+	size_t length; // the estimated slides per episode
+
+	std::shared_ptr<transposition> book; // the persistent table of book=, or null otherwise
+	size_t opening; // the slides of an episode whose root values are kept in the book
+};
+
+/**
+ * temporal difference learning player, i.e., slider
+ * select the slide with the maximal reward plus the estimated value of its afterstate,
+ * and learn the values of afterstates from the episode if alpha is nonzero
+ * without an initialized or loaded network, every afterstate is worth nothing and nothing is learned
+ *
+ * by default, the previous afterstate is updated with TD(0) after every slide;
+ * with batch=1, the afterstates of an episode are recorded and updated backward at the end of the episode,
+ * the TD(lambda) targets are computed from the recorded values, and the updates are then applied one table
+ * at a time so that the accesses stay within a single weight table
+ *
+ * with --threads, the sliders of all threads learn the same network concurrently; with buffer=<episodes>,
+ * the updates of a slider are accumulated in a sparse buffer and applied to the shared network every few episodes,
+ * which reduces the contention on the shared tables, but the values do not reflect the pending updates
+ *
+ * options: alpha=<learning rate> lambda=<trace decay for batch mode> batch=<0|1> buffer=<episodes per flush>
+ */
+class td_slider : public weight_agent {
+public:
+	td_slider(const std::string& args = "") : weight_agent("name=td role=slider lambda=0 batch=0 buffer=0 " + args),
+		lambda(float(meta["lambda"])), batch(int(meta["batch"])), buffer(unsigned(meta["buffer"])), episodes(0) {}
+	virtual ~td_slider() { flush(); }
+
+	virtual void open_episode(const std::string& flag = "") {
+		features.clear();
+		values.clear();
+		rewards.clear();
+		phases.clear();
+	}
+
+	virtual void close_episode(const std::string& flag = "") {
+		if (alpha && values.size()) {
+			if (batch) {
+				learn_backward();
+			} else {
+				learn(&features[features.size() - tuples.features()], phases.back(), alpha * (0 - values.back()));
+			}
+			if (buffer && ++episodes % buffer == 0) flush();
+		}
+		weight_agent::close_episode(flag);
+	}
+
+	virtual action take_action(const board& state) {
+		std::array<bitboard, 4> after;
+		std::array<board::reward, 4> score;
+		state.afterstates(after, score);
+		int best_op = -1;
+		float best = 0, best_value = 0;
+		board::reward best_reward = 0;
+		uint32_t idx[4][ntuple::max_patterns * 8];
+		size_t stage[4];
+		for (int op = 0; op < 4; op++) {
+			board::reward reward = score[op];
+			if (reward == -1) continue;
+			tuples.indices(after[op], idx[op]);
+			stage[op] = weight_agent::stage(after[op]);
+			float value = weighted() ? estimate(idx[op], stage[op]) : 0;
+			if (best_op == -1 || reward + value > best) {
+				best_op = op;
+				best = reward + value;
+				best_value = value;
+				best_reward = reward;
+			}
+		}
+		if (best_op == -1) return action();
+
+		if (alpha && weighted()) {
+			if (!batch && values.size()) {
+				learn(&features[0], phases.back(), alpha * (best - values.back()));
+				features.clear();
+				values.clear();
+				rewards.clear();
+				phases.clear();
+			}
+			features.insert(features.end(), idx[best_op], idx[best_op] + tuples.features());
+			values.push_back(best_value);
+			rewards.push_back(best_reward);
+			phases.push_back(stage[best_op]);
+		}
+		return action::slide(best_op);
+	}
+
+protected:
+	/**
+	 * update the recorded afterstates toward their TD(lambda) targets
+	 * the target of the last afterstate is zero since the episode ends after it
+	 */
+	void learn_backward() {
+		size_t num = values.size(), len = tuples.features();
+		std::vector<float> error(num);
+		float target = 0;
+		for (size_t t = num; t-- > 0; ) {
+			error[t] = alpha * (target - values[t]);
+			target = rewards[t] + (1 - lambda) * values[t] + lambda * target;
+		}
+		for (size_t s = 0; s < stages(); s++) {
+			for (size_t i = 0; i < tuples.size(); i++) {
+				weight& w = tables(s)[i];
+				for (size_t t = 0; t < num; t++) {
+					if (phases[t] != s) continue;
+					const uint32_t* idx = &features[t * len + i * 8];
+					for (size_t k = 0; k < 8; k++) learn(w, idx[k], error[t]);
+				}
+			}
+		}
+	}
+
+	/**
+	 * adjust the features of an afterstate in the given stage by u
+	 */
+	void learn(const uint32_t* idx, size_t s, float u) {
+		weight* net = tables(s);
+		if (!buffer) {
+			tuples.update(idx, net, u);
+			return;
+		}
+		for (size_t i = 0; i < tuples.size(); i++)
+			for (size_t k = 0; k < 8; k++) learn(net[i], idx[i * 8 + k], u);
+	}
+	void learn(weight& w, uint32_t i, float u) {
+		if (buffer) pending[&w[i]] += u;
+		else w.add(i, u);
+	}
+
+	/**
+	 * apply the buffered updates to the shared network
+	 */
+	void flush() {
+		for (const auto& update : pending) weight::add(update.first, update.second);
+		pending.clear();
+	}
+
+protected:
+	float lambda;
+	bool batch;
+	unsigned buffer;
+	size_t episodes;
+	std::unordered_map<float*, float> pending; // the buffered updates of weights
+	std::vector<uint32_t> features; // the features of the recorded afterstates, only the last one is kept in online mode
+	std::vector<float> values;
+	std::vector<board::reward> rewards;
+	std::vector<size_t> phases; // the stages of the recorded afterstates
+};
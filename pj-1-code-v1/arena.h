@@ -0,0 +1,96 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * arena.h: Zeroed memory blocks for large tables, optionally backed by huge pages
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <memory>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/**
+ * the allocator of zeroed blocks, e.g., the weight tables of a network, where a block is aligned to cache lines
+ *
+ * pages=heap allocates a block from the heap; otherwise the block is mapped anonymously and aligned to 2 MB,
+ * so the pages are only populated when they are touched: pages=small keeps the 4 KB pages, pages=thp advises the
+ * kernel to back the block with transparent huge pages, and pages=hugetlb takes the reserved huge pages,
+ * which falls back to thp if there are not enough of them
+ * with numa=interleave, the pages of a mapped block are spread over all NUMA nodes in round robin,
+ * so that the threads on every node see the same latency; by default the pages are placed on the node
+ * which first touches them
+ */
+class arena {
+public:
+	enum { line = 64, huge = 2 << 20 };
+
+	arena(const std::string& pages = "heap", const std::string& numa = "local") : pages(pages), interleave(false) {
+		if (pages != "heap" && pages != "small" && pages != "thp" && pages != "hugetlb")
+			throw std::invalid_argument("unknown page type: " + pages);
+		if (numa == "interleave") interleave = true;
+		else if (numa != "local") throw std::invalid_argument("unknown numa policy: " + numa);
+	}
+
+	/**
+	 * allocate a zeroed block of at least the given bytes, which is released with its last owner
+	 */
+	std::shared_ptr<char> allocate(size_t bytes) const {
+		if (pages == "heap" && !interleave) {
+			char* raw = new char[bytes + line]();
+			char* at = raw + (line - reinterpret_cast<uintptr_t>(raw) % line);
+			return std::shared_ptr<char>(at, [raw](char*) { delete[] raw; });
+		}
+
+		size_t len = (bytes + huge - 1) / huge * huge;
+		void* addr = MAP_FAILED;
+		if (pages == "hugetlb") {
+			addr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (addr == MAP_FAILED) std::cerr << "not enough huge pages reserved, use transparent huge pages instead" << std::endl;
+		}
+		if (addr != MAP_FAILED) {
+			bind(addr, len);
+			return std::shared_ptr<char>(static_cast<char*>(addr), [len](char* p) { ::munmap(p, len); });
+		}
+
+		// map another huge page so that the block can be aligned to a huge page
+		size_t span = len + huge;
+		addr = ::mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (addr == MAP_FAILED) throw std::bad_alloc();
+		char* at = static_cast<char*>(addr) + (huge - reinterpret_cast<uintptr_t>(addr) % huge) % huge;
+		if (pages != "small") ::madvise(at, len, MADV_HUGEPAGE);
+		bind(at, len);
+		return std::shared_ptr<char>(at, [addr, span](char*) { ::munmap(addr, span); });
+	}
+
+private:
+	/**
+	 * interleave the pages of a block over the online NUMA nodes, before any of them is touched
+	 */
+	void bind(void* addr, size_t len) const {
+		if (!interleave) return;
+		std::ifstream in("/sys/devices/system/node/online"); // e.g., "0-3" or "0,2-3"
+		unsigned long mask = 0;
+		for (std::string range; std::getline(in, range, ','); ) {
+			unsigned lo = std::stoul(range), hi = range.find('-') != std::string::npos ? std::stoul(range.substr(range.find('-') + 1)) : lo;
+			for (unsigned n = lo; n <= hi && n < 8 * sizeof(mask); n++) mask |= 1ul << n;
+		}
+		if ((mask & (mask - 1)) == 0) return; // a single node
+		const int policy = 3; // MPOL_INTERLEAVE of <linux/mempolicy.h>
+		if (::syscall(SYS_mbind, addr, len, policy, &mask, 8 * sizeof(mask) + 1, 0) != 0)
+			std::cerr << "failed to interleave the pages over the NUMA nodes" << std::endl;
+	}
+
+private:
+	std::string pages;
+	bool interleave;
+};
@@ -0,0 +1,258 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * bench.cpp: Benchmarks of boards, agents, episodes, and statistics
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <sstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include "board.h"
+#include "bitboard.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "statistics.h"
+
+/**
+ * a fixed corpus of played episodes, and the states before each slide and each placement
+ */
+struct corpus {
+	std::vector<episode> games;
+	std::vector<board> slides, places;
+	std::vector<std::pair<board, action>> moves;
+
+	corpus(size_t total, const std::string& seed) {
+		random_slider_2 slide("seed=" + seed);
+		random_placer place("seed=" + seed);
+		for (size_t n = 0; n < total; n++) {
+			games.emplace_back();
+			episode& game = games.back();
+			game.open_episode(slide.name() + ":" + place.name());
+			while (true) {
+				agent& who = game.take_turns(slide, place);
+				board state = game.state();
+				action move = who.take_action(state);
+				if (game.apply_action(move) != true) break;
+				(&who == &slide ? slides : places).push_back(state);
+				moves.emplace_back(state, move);
+			}
+			game.close_episode(game.last_turns(slide, place).name());
+		}
+	}
+};
+
+/**
+ * run a benchmark for at least the given time after a warmup,
+ * where each run of the function performs the returned number of operations
+ * the results are printed as tab-separated name, ns/op, ops/s, and the number of operations
+ */
+class bench {
+public:
+	bench(const std::string& filter, double millisec) : filter(filter), millisec(millisec), sink(0) {
+		std::cout << "# name\tns/op\tops/s\tops" << std::endl;
+	}
+
+	void operator()(const std::string& name, std::function<size_t()> run) {
+		if (name.find(filter) == std::string::npos) return;
+		typedef std::chrono::steady_clock clock;
+		auto elapsed = [](clock::time_point since) {
+			return std::chrono::duration<double, std::milli>(clock::now() - since).count();
+		};
+		for (auto warm = clock::now(); elapsed(warm) < millisec / 10; ) run();
+		size_t ops = 0;
+		auto start = clock::now();
+		double time;
+		do ops += run(); while ((time = elapsed(start)) < millisec);
+		double nsop = time * 1e6 / ops;
+		std::cout << name << '\t' << nsop << '\t' << uint64_t(1e9 / nsop) << '\t' << ops << std::endl;
+	}
+
+	/**
+	 * keep a result alive so that the measured work is not optimized out
+	 */
+	template<typename type> void keep(const type& v) { sink += uint64_t(v); }
+	uint64_t checksum() const { return sink; }
+
+private:
+	std::string filter;
+	double millisec;
+	uint64_t sink;
+};
+
+int main(int argc, const char* argv[]) {
+	std::cout << "# Threes! Benchmark: ";
+	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
+	std::cout << std::endl;
+
+	size_t total = 100;
+	double time = 200;
+	std::string seed = "0", filter;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto match_arg = [&](std::string flag) -> bool {
+			auto it = arg.find_first_not_of('-');
+			return arg.find(flag, it) == it;
+		};
+		auto next_opt = [&]() -> std::string {
+			auto it = arg.find('=') + 1;
+			return it ? arg.substr(it) : argv[++i];
+		};
+		if (match_arg("total")) {
+			total = std::max(std::stoull(next_opt()), 1ull);
+		} else if (match_arg("time")) {
+			time = std::stod(next_opt());
+		} else if (match_arg("seed")) {
+			seed = next_opt();
+		} else if (match_arg("filter")) {
+			filter = next_opt();
+		}
+	}
+
+	corpus data(total, seed);
+	bench run(filter, time);
+
+	const char* dir = "URDL";
+	for (int op = 0; op < 4; op++) {
+		run(std::string("board::slide_") + dir[op], [&]() {
+			for (const board& b : data.slides) run.keep(board(b).slide(op));
+			return data.slides.size();
+		});
+	}
+	for (int op = 0; op < 4; op++) {
+		std::vector<bitboard> slides(data.slides.begin(), data.slides.end());
+		run(std::string("bitboard::slide_") + dir[op], [&, slides]() {
+			for (const bitboard& b : slides) run.keep(bitboard(b).slide(op));
+			return slides.size();
+		});
+	}
+	{
+		std::vector<bitboard> slides(data.slides.begin(), data.slides.end());
+		run("bitboard::afterstates", [&, slides]() {
+			std::array<bitboard, 4> after;
+			std::array<board::reward, 4> reward;
+			for (const bitboard& b : slides) b.afterstates(after, reward), run.keep(reward[0] + after[3].raw());
+			return slides.size();
+		});
+	}
+	run("board::place", [&]() {
+		size_t ops = 0;
+		for (const auto& mv : data.moves) {
+			if (mv.second.type() != action::place::type) continue;
+			action::place p(mv.second);
+			run.keep(board(mv.first).place(p.position(), p.tile(), p.hint()));
+			ops++;
+		}
+		return ops;
+	});
+	run("action::apply", [&]() {
+		for (const auto& mv : data.moves) {
+			board b = mv.first;
+			run.keep(mv.second.apply(b));
+		}
+		return data.moves.size();
+	});
+
+	auto take_action = [&](const std::string& name, agent& who, const std::vector<board>& states) {
+		run(name + "::take_action", [&]() {
+			for (const board& b : states) run.keep(who.take_action(b).event());
+			return states.size();
+		});
+	};
+	random_slider slider("seed=" + seed);
+	random_slider_1 slider_1("seed=" + seed);
+	random_slider_2 slider_2("seed=" + seed);
+	random_placer placer("seed=" + seed);
+	expectimax_slider expectimax("depth=2 tt=16");
+	take_action("random_slider", slider, data.slides);
+	take_action("random_slider_1", slider_1, data.slides);
+	take_action("random_slider_2", slider_2, data.slides);
+	take_action("random_placer", placer, data.places);
+	take_action("expectimax_slider", expectimax, data.slides);
+	{
+		td_slider td("tuple=0123,4567,0145,1256 init=65536,65536,65536,65536");
+		take_action("td_slider", td, data.slides);
+	}
+
+	run("episode::operator<<", [&]() {
+		std::stringstream out;
+		for (const episode& ep : data.games) out << ep << std::endl;
+		run.keep(out.tellp());
+		return data.games.size();
+	});
+	run("episode::encode", [&]() {
+		std::string out;
+		for (const episode& ep : data.games) ep.encode(out), out.push_back('\n');
+		run.keep(out.size());
+		return data.games.size();
+	});
+	run("episode::write", [&]() {
+		std::stringstream out;
+		for (const episode& ep : data.games) ep.write(out);
+		run.keep(out.tellp());
+		return data.games.size();
+	});
+	{
+		std::stringstream text, binary;
+		for (const episode& ep : data.games) text << ep << std::endl, ep.write(binary);
+		const std::string texts = text.str(), binaries = binary.str();
+		run("episode::operator>>", [&]() {
+			std::stringstream in(texts);
+			episode ep;
+			for (std::string line; std::getline(in, line); ) std::stringstream(line) >> ep, run.keep(ep.score());
+			return data.games.size();
+		});
+		run("episode::decode", [&]() {
+			episode ep;
+			for (const char* it = texts.data(), *end = it + texts.size(); it != end; ) {
+				const char* eol = std::find(it, end, '\n');
+				ep.decode(it, eol);
+				run.keep(ep.score());
+				it = eol + (eol != end);
+			}
+			return data.games.size();
+		});
+		run("episode::read", [&]() {
+			std::stringstream in(binaries);
+			episode ep;
+			while (ep.read(in)) run.keep(ep.score());
+			return data.games.size();
+		});
+	}
+
+	{
+		statistics stats(total, 0, total);
+		std::stringstream text;
+		for (const episode& ep : data.games) text << ep << std::endl;
+		stats.load(text);
+		for (bool binary : { false, true }) {
+			std::stringstream out;
+			stats.save(out, binary);
+			const std::string saved = out.str();
+			std::string format = binary ? "(binary)" : "(text)";
+			run("statistics::save" + format, [&]() {
+				std::stringstream out;
+				stats.save(out, binary);
+				run.keep(out.tellp());
+				return data.games.size();
+			});
+			run("statistics::load" + format, [&]() {
+				std::stringstream in(saved);
+				statistics loaded(total, 0, total);
+				loaded.load(in);
+				run.keep(loaded.step());
+				return data.games.size();
+			});
+		}
+	}
+
+	std::cout << "# checksum " << run.checksum() << std::endl;
+	return 0;
+}
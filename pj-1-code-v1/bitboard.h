@@ -0,0 +1,417 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * bitboard.h: Define the packed 64-bit game state and table-driven operations
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <array>
+#include <iostream>
+#include <iomanip>
+#include "profile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/**
+ * packed bitboard for Threes!
+ * each tile index is stored as a 4-bit nibble, cell (i) occupies bits [4i, 4i + 4)
+ *
+ * index (1-d form):
+ *  (0)  (1)  (2)  (3)
+ *  (4)  (5)  (6)  (7)
+ *  (8)  (9) (10) (11)
+ * (12) (13) (14) (15)
+ *
+ * the interface mirrors board, the sliding operations are looked up from
+ * precomputed tables so that one slide costs four row (or column) lookups
+ */
+class bitboard {
+public:
+	typedef uint32_t cell;
+	typedef uint64_t grid;
+	typedef uint64_t data;
+	typedef uint64_t score;
+	typedef int reward;
+
+public:
+	bitboard() : tile(0), attr(0) { reset(); }
+	bitboard(grid b, data v = 0) : tile(b), attr(v) {}
+	bitboard(const bitboard& b) = default;
+	bitboard& operator =(const bitboard& b) = default;
+
+	grid raw() const { return tile; }
+	grid raw(grid b) { grid old = tile; tile = b; return old; }
+	cell operator ()(unsigned i) const { return (tile >> (4 * i)) & 0x0fu; }
+	cell at(unsigned i) const { return operator()(i); }
+	void set(unsigned i, cell t) { tile = (tile & ~(grid(0x0fu) << (4 * i))) | (grid(t & 0x0fu) << (4 * i)); }
+
+	/**
+	 * the mask of empty cells, bit (i) is set if cell (i) is empty
+	 */
+	unsigned empty() const {
+		grid x = tile | (tile >> 1);
+		x = (x | (x >> 2)) & 0x1111111111111111ull;
+		x = (x | (x >> 3)) & 0x0303030303030303ull;
+		x = (x | (x >> 6)) & 0x000f000f000f000full;
+		x = (x | (x >> 12)) & 0x000000ff000000ffull;
+		x = (x | (x >> 24)) & 0xffffull;
+		return ~unsigned(x) & 0xffffu;
+	}
+
+	/**
+	 * the largest tile index on the board
+	 */
+	cell max_tile() const {
+		cell max = 0;
+		for (grid x = tile; x; x >>= 4) max = std::max<cell>(max, x & 0x0fu);
+		return max;
+	}
+
+	data info() const { return attr; }
+	data info(data dat) { data old = attr; attr = dat; return old; }
+
+private:
+	data info4(size_t i) const { return (info() >> (4 * i)) & 0x0fu; }
+	data info4(size_t i, data dat) { data old = info4(i); info(info() ^ ((old ^ dat) << (4 * i))); return old; }
+
+public:
+	static unsigned itot(unsigned i) { return i >= 3 ? 3 * (1 << (i - 3)) : i; }
+	static unsigned ttoi(unsigned t) { return t >= 3 ? std::log2(t / 3) + 3 : t; }
+	static unsigned itov(unsigned i) { return ttov(itot(i)); }
+	static unsigned ttov(unsigned t) { return t >= 3 ? std::pow(3, std::log2(t / 3) + 1) : 0; }
+
+	cell hint() const { return info4(0); }
+	cell hint(cell t) { return info4(0, t); }
+	unsigned last() const { return info4(1); }
+	unsigned last(unsigned a) { return info4(1, a); }
+	unsigned bag(cell t) const { return info4(t + 1); }
+	unsigned bag(cell t, unsigned n) { return info4(t + 1, n); }
+
+	void reset() {
+		hint(0);
+		last(4);
+		reset_bag();
+	}
+	void reset_bag() {
+		for (cell t = 1; t <= 3; t++) bag(t, 1);
+	}
+	bool extract_hint_from_bag(cell t) {
+		if (bag(t) < 1) return false;
+		bag(t, bag(t) - 1);
+		if (bag(1) + bag(2) + bag(3) == 0) reset_bag();
+		hint(t);
+		return true;
+	}
+	unsigned value() const {
+		score v = 0;
+		for (unsigned i = 0; i < 4; i++) v += lookup::find().value[(tile >> (16 * i)) & 0xffffu];
+		return v;
+	}
+
+public:
+	bool operator ==(const bitboard& b) const { return tile == b.tile; }
+	bool operator < (const bitboard& b) const { return tile <  b.tile; }
+	bool operator !=(const bitboard& b) const { return !(*this == b); }
+	bool operator > (const bitboard& b) const { return b < *this; }
+	bool operator <=(const bitboard& b) const { return !(b < *this); }
+	bool operator >=(const bitboard& b) const { return !(*this < b); }
+
+public:
+
+	/**
+	 * place a tile (index value) to the specific position (1-d index)
+	 * return >= 0 if the action is valid, or -1 if not
+	 */
+	reward place(unsigned pos, cell tile, cell hint_tile) {
+		PROFILE_SCOPE(profile::place);
+		data bak = info();
+		if (pos >= 16 || operator()(pos)) return -1;
+		if (hint() == 0 && !extract_hint_from_bag(tile)) return -1;
+		if (hint() != tile) return info(bak), -1;
+		if (!extract_hint_from_bag(hint_tile)) return info(bak), -1;
+		set(pos, tile);
+		last(4);
+		return itov(tile);
+	}
+
+	/**
+	 * apply an action to the board
+	 * return the reward of the action, or -1 if the action is illegal
+	 */
+	reward slide(unsigned opcode) {
+		PROFILE_SCOPE(profile::slide);
+		reward r = -1;
+		switch (opcode & 0b11) {
+		case 0: r = slide_up(); break;
+		case 1: r = slide_right(); break;
+		case 2: r = slide_down(); break;
+		case 3: r = slide_left(); break;
+		}
+		if (r != -1) last(opcode & 0b11);
+		return r;
+	}
+
+	reward slide_left() {
+		const lookup& t = lookup::find();
+		grid next = 0;
+		reward score = 0;
+		for (unsigned i = 0; i < 4; i++) {
+			unsigned row = (tile >> (16 * i)) & 0xffffu;
+			next |= grid(t.left[row]) << (16 * i);
+			score += t.left_score[row];
+		}
+		return move_to(next, score);
+	}
+	reward slide_right() {
+		const lookup& t = lookup::find();
+		grid next = 0;
+		reward score = 0;
+		for (unsigned i = 0; i < 4; i++) {
+			unsigned row = (tile >> (16 * i)) & 0xffffu;
+			next |= grid(t.right[row]) << (16 * i);
+			score += t.right_score[row];
+		}
+		return move_to(next, score);
+	}
+	reward slide_up() {
+		const lookup& t = lookup::find();
+		grid next = 0;
+		reward score = 0;
+		for (unsigned i = 0; i < 4; i++) {
+			unsigned col = column(i);
+			next |= t.up[col] << (4 * i);
+			score += t.left_score[col];
+		}
+		return move_to(next, score);
+	}
+	reward slide_down() {
+		const lookup& t = lookup::find();
+		grid next = 0;
+		reward score = 0;
+		for (unsigned i = 0; i < 4; i++) {
+			unsigned col = column(i);
+			next |= t.down[col] << (4 * i);
+			score += t.right_score[col];
+		}
+		return move_to(next, score);
+	}
+
+	/**
+	 * the mask of legal slides, bit (op) is set if slide(op) would change the board
+	 */
+	unsigned moves() const {
+		const lookup& t = lookup::find();
+		unsigned rows = 0, cols = 0;
+		for (unsigned i = 0; i < 4; i++) {
+			rows |= t.moved[(tile >> (16 * i)) & 0xffffu];
+			cols |= t.moved[column(i)];
+		}
+		return (cols & 0b01) | (rows & 0b10) | ((cols & 0b10) << 1) | ((rows & 0b01) << 3);
+	}
+
+	/**
+	 * compute the afterstates and rewards of all four slides in one pass, indexed by opcode
+	 * the afterstate of an illegal slide is left unchanged, and its reward is -1
+	 */
+	void afterstates(std::array<bitboard, 4>& after, std::array<reward, 4>& score) const {
+		const lookup& t = lookup::find();
+		grid next[4] = { 0, 0, 0, 0 };
+		score = {{ 0, 0, 0, 0 }};
+		for (unsigned i = 0; i < 4; i++) {
+			unsigned row = (tile >> (16 * i)) & 0xffffu, col = column(i);
+			next[0] |= t.up[col] << (4 * i);
+			next[1] |= grid(t.right[row]) << (16 * i);
+			next[2] |= t.down[col] << (4 * i);
+			next[3] |= grid(t.left[row]) << (16 * i);
+			score[0] += t.left_score[col];
+			score[1] += t.right_score[row];
+			score[2] += t.right_score[col];
+			score[3] += t.left_score[row];
+		}
+		for (unsigned op = 0; op < 4; op++) {
+			after[op] = *this;
+			if (next[op] == tile) {
+				score[op] = -1;
+				continue;
+			}
+			after[op].tile = next[op];
+			after[op].last(op);
+		}
+	}
+
+	/**
+	 * the 8 isomorphisms of the board, where isomorphism (k) is reflected horizontally if k >= 4,
+	 * and then rotated clockwise (k % 4) times
+	 * the last action is mapped along with the tiles, e.g., a right slide becomes a down slide after a clockwise rotation,
+	 * so that the edge of the next placement is mapped consistently; the hint and the bag are unchanged
+	 */
+	void isomorphisms(std::array<bitboard, 8>& iso) const {
+		bitboard t = *this, tr = t;
+		tr.transpose();
+		iso[0] = t;
+		iso[7] = tr;
+		iso[4] = t, iso[4].reflect_horizontal();
+		iso[6] = t, iso[6].reflect_vertical();
+		iso[2] = iso[4], iso[2].reflect_vertical();
+		iso[1] = tr, iso[1].reflect_horizontal();
+		iso[3] = tr, iso[3].reflect_vertical();
+		iso[5] = iso[1], iso[5].reflect_vertical();
+		unsigned op = last();
+		if (op < 4) {
+			for (unsigned k = 0; k < 8; k++)
+				iso[k].last(((k >= 4 ? 4 - op : op) + k) % 4);
+		}
+	}
+
+	/**
+	 * the canonical form of the board, i.e., the minimal one of its 8 isomorphisms,
+	 * compared by the tiles and then by the attributes
+	 */
+	bitboard canonical() const {
+		std::array<bitboard, 8> iso;
+		isomorphisms(iso);
+		bitboard min = iso[0];
+		for (unsigned k = 1; k < 8; k++) {
+			if (iso[k].tile < min.tile || (iso[k].tile == min.tile && iso[k].attr < min.attr))
+				min = iso[k];
+		}
+		return min;
+	}
+
+	void rotate(int clockwise_count = 1) {
+		switch (((clockwise_count % 4) + 4) % 4) {
+		default:
+		case 0: break;
+		case 1: rotate_clockwise(); break;
+		case 2: reverse(); break;
+		case 3: rotate_counterclockwise(); break;
+		}
+	}
+
+	void rotate_clockwise() { transpose(); reflect_horizontal(); }
+	void rotate_counterclockwise() { transpose(); reflect_vertical(); }
+	void reverse() { reflect_horizontal(); reflect_vertical(); }
+
+	void reflect_horizontal() {
+		tile = ((tile & 0x000f000f000f000full) << 12) | ((tile & 0x00f000f000f000f0ull) << 4)
+		     | ((tile & 0x0f000f000f000f00ull) >> 4) | ((tile & 0xf000f000f000f000ull) >> 12);
+	}
+
+	void reflect_vertical() {
+		tile = ((tile & 0x000000000000ffffull) << 48) | ((tile & 0x00000000ffff0000ull) << 16)
+		     | ((tile & 0x0000ffff00000000ull) >> 16) | ((tile & 0xffff000000000000ull) >> 48);
+	}
+
+	void transpose() {
+		tile = (tile & 0xf0f00f0ff0f00f0full) | ((tile & 0x0000f0f00000f0f0ull) << 12) | ((tile & 0x0f0f00000f0f0000ull) >> 12);
+		tile = (tile & 0xff00ff0000ff00ffull) | ((tile & 0x00000000ff00ff00ull) << 24) | ((tile & 0x00ff00ff00000000ull) >> 24);
+	}
+
+private:
+	/**
+	 * gather column (i) into a 16-bit row, the top cell becomes the lowest nibble
+	 */
+	unsigned column(unsigned i) const {
+		grid c = (tile >> (4 * i)) & 0x000f000f000f000full;
+		return (c | (c >> 12) | (c >> 24) | (c >> 36)) & 0xffffu;
+	}
+
+	reward move_to(grid next, reward score) {
+		if (next == tile) return -1;
+		tile = next;
+		return score;
+	}
+
+	/**
+	 * the precomputed results of sliding a single row (or column) toward its lowest nibble (left)
+	 * or toward its highest nibble (right), indexed by the 16-bit row value
+	 */
+	struct lookup {
+		std::array<uint16_t, 65536> left, right;
+		std::array<grid, 65536> up, down;
+		std::array<reward, 65536> left_score, right_score;
+		std::array<unsigned, 65536> value;
+		std::array<uint8_t, 65536> moved; // bit 0 if the row can slide left, bit 1 if it can slide right
+
+		lookup() {
+			for (unsigned row = 0; row < 65536; row++) {
+				cell t[4] = { row & 0x0fu, (row >> 4) & 0x0fu, (row >> 8) & 0x0fu, (row >> 12) & 0x0fu };
+				value[row] = itov(t[0]) + itov(t[1]) + itov(t[2]) + itov(t[3]);
+
+				cell l[4] = { t[0], t[1], t[2], t[3] };
+				left_score[row] = slide_row(l);
+				left[row] = l[0] | (l[1] << 4) | (l[2] << 8) | (l[3] << 12);
+				up[row] = spread(left[row]);
+
+				cell r[4] = { t[3], t[2], t[1], t[0] };
+				right_score[row] = slide_row(r);
+				right[row] = r[3] | (r[2] << 4) | (r[1] << 8) | (r[0] << 12);
+				down[row] = spread(right[row]);
+
+				moved[row] = (left[row] != row ? 0b01 : 0) | (right[row] != row ? 0b10 : 0);
+			}
+		}
+
+		/**
+		 * slide a row toward index 0, following the rule of board::slide_left
+		 * tiles of the row are updated in place, and the reward is returned
+		 */
+		static reward slide_row(cell row[4]) {
+			reward score = 0;
+			for (int c = 1; c < 4; c++) {
+				cell& t0 = row[c - 1];
+				cell& t1 = row[c];
+				if (t0 == 0) {
+					t0 = t1;
+					t1 = 0;
+				} else if (t1 != 0 && ((t0 + t1 == 3) || (t0 == t1 && t0 >= 3 && t0 < 14))) {
+					t0 = std::max(t0, t1) + 1;
+					t1 = 0;
+					score += itov(t0) - itov(t0 - 1) * 2;
+				}
+			}
+			return score;
+		}
+
+		static grid spread(unsigned row) {
+			grid r = row;
+			return (r & 0x000fu) | ((r & 0x00f0u) << 12) | ((r & 0x0f00u) << 24) | ((r & 0xf000u) << 36);
+		}
+
+		static const lookup& find() { static const lookup table; return table; }
+	};
+
+public:
+	friend std::ostream& operator <<(std::ostream& out, const bitboard& b) {
+		out << "+------------------------+" << std::endl;
+		for (int i = 0; i < 4; i++) {
+			out << "|" << std::dec;
+			for (int j = 0; j < 4; j++) out << std::setw(6) << itot(b(i * 4 + j));
+			out << "|";
+			switch (i) {
+			case 0: out << " Hint: " << "X123+"[b.hint()]; break;
+			case 1: out << " Last: " << "URDLX"[b.last()]; break;
+			}
+			out << std::endl;
+		}
+		out << "+------------------------+" << std::endl;
+		return out;
+	}
+	friend std::istream& operator >>(std::istream& in, bitboard& b) {
+		for (int i = 0; i < 16; i++) {
+			while (!std::isdigit(in.peek()) && in.good()) in.ignore(1);
+			unsigned t = 0;
+			in >> t;
+			b.set(i, ttoi(t));
+		}
+		return in;
+	}
+
+private:
+	grid tile;
+	data attr; // (#3-tile:4-bit) (#2-tile:4-bit) (#1-tile:4-bit) (last_action:4-bit) (hint_tile:4-bit)
+};
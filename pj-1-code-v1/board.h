@@ -13,6 +13,8 @@
 #include <iomanip>
 #include <algorithm>
 #include <cmath>
+#include "bitboard.h"
+#include "profile.h"
 
 /**
  * array-based board for Threes!
@@ -38,6 +40,12 @@ public:
 	board(const grid& b, data v = 0) : tile(b), attr(v) {}
 	board(const board& b) = default;
 	board& operator =(const board& b) = default;
+	explicit board(const bitboard& b) : tile(), attr(b.info()) { for (int i = 0; i < 16; i++) operator()(i) = b(i); }
+	operator bitboard() const {
+		bitboard::grid b = 0;
+		for (int i = 0; i < 16; i++) b |= bitboard::grid(operator()(i) & 0x0fu) << (4 * i);
+		return bitboard(b, attr);
+	}
 
 	operator grid&() { return tile; }
 	operator const grid&() const { return tile; }
@@ -107,6 +115,7 @@ public:
 	 * return >= 0 if the action is valid, or -1 if not
 	 */
 	reward place(unsigned pos, cell tile, cell hint_tile) {
+		PROFILE_SCOPE(profile::place);
 		data bak = info();
 		if (pos >= 16 || operator()(pos)) return -1;
 		if (hint() == 0 && !extract_hint_from_bag(tile)) return -1;
@@ -122,6 +131,7 @@ public:
 	 * return the reward of the action, or -1 if the action is illegal
 	 */
 	reward slide(unsigned opcode) {
+		PROFILE_SCOPE(profile::slide);
 		reward r = -1;
 		switch (opcode & 0b11) {
 		case 0: r = slide_up(); break;
@@ -174,6 +184,20 @@ public:
 		return score;
 	}
 
+	/**
+	 * the mask of legal slides, bit (op) is set if slide(op) is legal
+	 */
+	unsigned moves() const {
+		return bitboard(*this).moves();
+	}
+
+	/**
+	 * the packed afterstates and rewards of all four slides, see bitboard::afterstates
+	 */
+	void afterstates(std::array<bitboard, 4>& after, std::array<reward, 4>& score) const {
+		bitboard(*this).afterstates(after, score);
+	}
+
 	void rotate(int clockwise_count = 1) {
 		switch (((clockwise_count % 4) + 4) % 4) {
 		default:
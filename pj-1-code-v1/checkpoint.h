@@ -0,0 +1,332 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * checkpoint.h: Crash-safe file images and their periodic snapshots in the background
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * the content of a file as a sequence of regions, where a region either views the memory of its owner,
+ * e.g., a weight table, or holds a copy of a few bytes, e.g., a header
+ */
+class image {
+public:
+	void append(const void* data, size_t size) {
+		if (size) regions.push_back({ static_cast<const char*>(data), 0, size });
+	}
+	void append(const std::string& bytes) {
+		if (bytes.size()) regions.push_back({ nullptr, constants.size(), bytes.size() });
+		constants += bytes;
+	}
+	template<typename value_t>
+	void append(value_t value) {
+		append(std::string(reinterpret_cast<const char*>(&value), sizeof(value)));
+	}
+
+	size_t size() const {
+		size_t size = 0;
+		for (const region& r : regions) size += r.size;
+		return size;
+	}
+	/**
+	 * copy the content to a buffer of at least size() bytes
+	 * the viewed memory is read by relaxed atomic loads of 32-bit words if aligned, so it may be written
+	 * concurrently with the relaxed atomic stores of basic_weight::add, where each word is read untorn
+	 */
+	void gather(char* out) const {
+		for (const region& r : regions) {
+			const char* in = at(r);
+			size_t i = 0;
+			if (r.data && reinterpret_cast<uintptr_t>(in) % sizeof(uint32_t) == 0) {
+				for (uint32_t w; i + sizeof(w) <= r.size; i += sizeof(w)) {
+					w = __atomic_load_n(reinterpret_cast<const uint32_t*>(in + i), __ATOMIC_RELAXED);
+					std::memcpy(out + i, &w, sizeof(w));
+				}
+			}
+			std::memcpy(out + i, in + i, r.size - i);
+			out += r.size;
+		}
+	}
+	bool write(int fd) const {
+		for (const region& r : regions) {
+			for (size_t off = 0; off < r.size; ) {
+				ssize_t num = ::write(fd, at(r) + off, r.size - off);
+				if (num < 0) return false;
+				off += num;
+			}
+		}
+		return true;
+	}
+
+private:
+	struct region {
+		const char* data; // the viewed memory, or null for the bytes in the constants
+		size_t offset; // the offset in the constants
+		size_t size;
+	};
+	const char* at(const region& r) const { return r.data ? r.data : constants.data() + r.offset; }
+
+	std::vector<region> regions;
+	std::string constants;
+};
+
+/**
+ * periodic snapshots of an image, e.g., the weight file of a network in training, written by a background thread
+ *
+ * every few episodes, the thread copies the image into its own buffer, and then writes the buffer while the owner
+ * of the image continues; a snapshot is skipped if the previous one is still being written, so the owner never waits
+ * the snapshots are best-effort and not point-in-time: the writers, e.g., the training threads, are neither paused
+ * nor double-buffered, and the copy is not copy-on-write, so a snapshot is not a consistent cut of the tables,
+ * i.e., each weight is read untorn at some time during the copy, and the weights of an episode may be partly before
+ * and partly after its updates
+ * the file is always replaced by rename, and the directory is then flushed, so a crash at any time leaves either
+ * the previous or the new snapshot
+ *
+ * with delta mode, only the pages which differ from the previous snapshot are appended to path.delta as a record,
+ * which identifies the images before and after it by their digests, so the records are applied in order to the last
+ * full snapshot, and a stale or torn record ends the log; a full snapshot is written again, and the log is removed,
+ * when the log would exceed half of the image; the pages are not tracked as they are written, instead they are found
+ * by comparing each copy with the previous one, so delta mode keeps another full copy of the image in memory
+ *
+ * a record of the delta file is formatted as
+ * (magic "TCGD":4-byte) (page size:4-byte) (image size:8-byte) (digest before:8-byte) (digest after:8-byte)
+ * (#page:8-byte) (digest of the pages:8-byte), followed by the offset (8-byte) and the content of each page
+ */
+class checkpoint {
+public:
+	checkpoint(const std::string& path, const image& content, size_t every, bool delta = false)
+		: path(path), content(content), every(std::max<size_t>(every, 1)), delta(delta), digest(0), logged(0),
+		  episodes(0), pending(false), stop(false), writer(&checkpoint::work, this) {}
+	~checkpoint() { close(); }
+
+	/**
+	 * count an episode, and take a snapshot every few episodes
+	 */
+	void tick() {
+		if (++episodes % every) return;
+		std::lock_guard<std::mutex> guard(lock);
+		if (pending || stop) return;
+		pending = true;
+		wake.notify_one();
+	}
+	/**
+	 * stop taking snapshots, and wait for the one being written
+	 */
+	void close() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stop = true;
+		}
+		wake.notify_one();
+		if (writer.joinable()) writer.join();
+	}
+
+public:
+	/**
+	 * write an image to path.tmp, flush it to the disk, and replace the file at path
+	 */
+	static bool commit(const std::string& path, const image& content) {
+		std::string temp = path + ".tmp";
+		int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd == -1) return false;
+		bool ok = content.write(fd) && ::fsync(fd) == 0;
+		ok = ::close(fd) == 0 && ok;
+		return ok && std::rename(temp.c_str(), path.c_str()) == 0 && settle(path);
+	}
+
+	/**
+	 * flush the directory of a file, so that its rename or creation survives a crash
+	 */
+	static bool settle(const std::string& path) {
+		size_t slash = path.rfind('/');
+		std::string dir = slash == std::string::npos ? "." : slash ? path.substr(0, slash) : "/";
+		int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+		if (fd == -1) return false;
+		bool ok = ::fsync(fd) == 0;
+		return ::close(fd) == 0 && ok;
+	}
+
+	/**
+	 * apply the records of the delta at path in order to the image of a full snapshot loaded in memory,
+	 * until a record which does not follow the image, e.g., a stale or torn one
+	 * return false if no record is applied
+	 */
+	static bool patch(const std::string& path, char* data, size_t size) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd == -1) return false;
+		struct stat st;
+		std::string file;
+		if (::fstat(fd, &st) == 0) file.resize(st.st_size);
+		size_t got = 0;
+		for (ssize_t num = 1; got < file.size() && num > 0; got += std::max<ssize_t>(num, 0))
+			num = ::read(fd, &file[got], file.size() - got);
+		::close(fd);
+		if (got != file.size()) return false;
+		uint64_t current = checksum(data, size);
+		bool applied = false;
+		for (size_t off = 0; file.size() - off >= head; ) {
+			uint32_t magic, unit;
+			uint64_t len, from, to, num, hash;
+			std::memcpy(&magic, &file[off], 4);
+			std::memcpy(&unit, &file[off + 4], 4);
+			std::memcpy(&len, &file[off + 8], 8);
+			std::memcpy(&from, &file[off + 16], 8);
+			std::memcpy(&to, &file[off + 24], 8);
+			std::memcpy(&num, &file[off + 32], 8);
+			std::memcpy(&hash, &file[off + 40], 8);
+			if (magic != 0x44474354u || unit == 0 || len != size || from != current) break;
+			std::vector<std::pair<uint64_t, size_t>> pages; // each page is verified before any of them is applied
+			size_t end = off + head;
+			bool whole = true;
+			for (; num && whole; num--) {
+				uint64_t at = size;
+				if (file.size() - end >= sizeof(at)) std::memcpy(&at, &file[end], sizeof(at));
+				whole = at < size && file.size() - end - sizeof(at) >= std::min<uint64_t>(unit, size - at);
+				if (!whole) break;
+				pages.emplace_back(at, std::min<uint64_t>(unit, size - at));
+				end += sizeof(at) + pages.back().second;
+			}
+			if (!whole || checksum(&file[off + head], end - off - head) != hash) break;
+			size_t at = off + head;
+			for (const auto& p : pages) {
+				std::memcpy(data + p.first, &file[at + sizeof(uint64_t)], p.second);
+				at += sizeof(uint64_t) + p.second;
+			}
+			current = to;
+			applied = true;
+			off = end;
+		}
+		return applied;
+	}
+
+	/**
+	 * a 64-bit digest of a file image, which identifies the full snapshot of a delta
+	 */
+	static uint64_t checksum(const char* data, size_t size) {
+		uint64_t h = 0xcbf29ce484222325ull ^ size;
+		size_t i = 0;
+		for (uint64_t w; i + sizeof(w) <= size; i += sizeof(w)) {
+			std::memcpy(&w, data + i, sizeof(w));
+			h = (h ^ w) * 0x100000001b3ull;
+			h ^= h >> 29;
+		}
+		for (; i < size; i++) h = (h ^ uint8_t(data[i])) * 0x100000001b3ull;
+		return h;
+	}
+
+private:
+	enum { page = 4096, head = 48 }; // the size of a page, and the size of the header of a delta record
+
+	void work() {
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			wake.wait(guard, [this]() { return stop || pending; });
+			if (stop) return;
+			guard.unlock();
+			if (!snapshot()) std::cerr << "failed to write the checkpoint " << path << std::endl;
+			guard.lock();
+			pending = false;
+		}
+	}
+
+	bool snapshot() {
+		buffer.resize(content.size());
+		content.gather(buffer.data());
+		if (!delta) {
+			image full;
+			full.append(buffer.data(), buffer.size());
+			return commit(path, full);
+		}
+
+		std::vector<size_t> dirty;
+		if (base.size() == buffer.size()) {
+			for (size_t off = 0; off < buffer.size(); off += page) {
+				size_t len = std::min<size_t>(page, buffer.size() - off);
+				if (std::memcmp(&buffer[off], &base[off], len)) dirty.push_back(off);
+			}
+		}
+		size_t grow = head + dirty.size() * (sizeof(uint64_t) + page);
+		if (base.size() != buffer.size() || (logged + grow) * 2 > buffer.size()) {
+			uint64_t next = checksum(buffer.data(), buffer.size());
+			image full;
+			full.append(buffer.data(), buffer.size());
+			if (!commit(path, full)) return false;
+			std::remove((path + ".delta").c_str()); // a crash before the removal leaves a stale log, which is ignored
+			base.swap(buffer);
+			digest = next;
+			logged = 0;
+			return true;
+		}
+		if (dirty.empty()) return true;
+
+		pages.clear(); // the offset and the content of each page changed since the previous snapshot
+		for (size_t off : dirty) {
+			uint64_t at = off;
+			pages.append(reinterpret_cast<const char*>(&at), sizeof(at));
+			pages.append(&buffer[off], std::min<size_t>(page, buffer.size() - off));
+		}
+		uint64_t next = checksum(buffer.data(), buffer.size());
+		image diff;
+		diff.append(uint32_t(0x44474354u)); // "TCGD" in little endian
+		diff.append(uint32_t(page));
+		diff.append(uint64_t(buffer.size()));
+		diff.append(uint64_t(digest));
+		diff.append(uint64_t(next));
+		diff.append(uint64_t(dirty.size()));
+		diff.append(uint64_t(checksum(pages.data(), pages.size())));
+		diff.append(pages.data(), pages.size());
+		if (!append(path + ".delta", diff)) return false;
+		base.swap(buffer); // the next delta is taken against this snapshot
+		digest = next;
+		return true;
+	}
+
+	/**
+	 * append a record to the delta log after its complete records, i.e., a torn record of a failed write is overwritten
+	 */
+	bool append(const std::string& file, const image& record) {
+		int fd = ::open(file.c_str(), O_WRONLY | O_CREAT, 0644);
+		if (fd == -1) return false;
+		bool ok = ::ftruncate(fd, logged) == 0 && ::lseek(fd, logged, SEEK_SET) == off_t(logged)
+				&& record.write(fd) && ::fsync(fd) == 0;
+		ok = ::close(fd) == 0 && ok;
+		ok = ok && (logged || settle(file));
+		if (ok) logged += record.size();
+		return ok;
+	}
+
+private:
+	std::string path;
+	image content;
+	size_t every;
+	bool delta;
+	std::vector<char> buffer; // the latest copy of the image
+	std::vector<char> base; // the image of the previous snapshot, for delta mode
+	uint64_t digest; // the digest of the base
+	size_t logged; // the bytes of the complete records in the delta log
+	std::string pages; // the pages of the current delta record
+	std::atomic<size_t> episodes;
+	bool pending;
+	bool stop;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::thread writer;
+};
@@ -13,15 +13,33 @@
 #include <algorithm>
 #include <iostream>
 #include <sstream>
-#include <chrono>
 #include <numeric>
+#include <string>
+#include <cstdint>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
+#include "timer.h"
 
 class episode {
 public:
-	episode() : ep_state(initial_state()), ep_score(0), ep_time(0) { ep_moves.reserve(10000); }
+	episode() : ep_state(initial_state()), ep_score(0), ep_time(0), ep_begin(0), ep_end(0) {}
+
+	class pool;
+	explicit episode(pool& buffers);
+
+	/**
+	 * reset the episode to the initial state, while the move buffer is kept for reuse
+	 */
+	void reset() {
+		ep_state = initial_state();
+		ep_score = 0;
+		ep_moves.clear();
+		ep_time = 0;
+		ep_begin = ep_end = 0;
+		ep_open = {};
+		ep_close = {};
+	}
 
 public:
 	board& state() { return ep_state; }
@@ -30,19 +48,22 @@ public:
 
 	void open_episode(const std::string& tag) {
 		ep_open = { tag, millisec() };
+		ep_begin = timer::now();
 	}
 	void close_episode(const std::string& tag) {
 		ep_close = { tag, millisec() };
+		ep_end = timer::now();
 	}
 	bool apply_action(action move) {
 		board::reward reward = move.apply(state());
 		if (reward == -1) return false;
-		ep_moves.emplace_back(move, reward, millisec() - ep_time);
+		time_t spent = ep_time ? (timer::now() - ep_time) * timer::every() : 0;
+		ep_moves.emplace_back(move, reward, spent);
 		ep_score += reward;
 		return true;
 	}
 	agent& take_turns(agent& slide, agent& place) {
-		ep_time = millisec();
+		ep_time = timer::timed(step()) ? timer::now() : 0;
 		return step() >= 9 && (step() - 8) % 2 ? slide : place;
 	}
 	agent& last_turns(agent& slide, agent& place) {
@@ -59,6 +80,11 @@ public:
 		}
 	}
 
+	/**
+	 * the time spent in nanoseconds, by either the slider, the placer, or the whole episode
+	 * the whole episode is timed by the clock of the moves between its opening and closing, while the
+	 * millisecond timestamps are only kept for the records; a loaded episode sums the time of its moves instead
+	 */
 	time_t time(unsigned who = -1u) const {
 		time_t time = 0;
 		size_t i = 9;
@@ -71,12 +97,34 @@ public:
 			while (i < ep_moves.size()) time += ep_moves[i].time, i += 2;
 			break;
 		default:
-			time = ep_close.when - ep_open.when;
+			if (ep_end > ep_begin) time = ep_end - ep_begin;
+			else for (const move& mv : ep_moves) time += mv.time;
 			break;
 		}
 		return time;
 	}
 
+	/**
+	 * the time of each move in nanoseconds, by either the slider, the placer, or the whole episode
+	 */
+	std::vector<time_t> times(unsigned who = -1u) const {
+		std::vector<time_t> res;
+		size_t i = 9;
+		switch (who) {
+		case action::place::type:
+			if (ep_moves.size())
+				for (i = 0; i < 8; i++) res.push_back(ep_moves[i].time);
+			// no break;
+		case action::slide::type:
+			while (i < ep_moves.size()) res.push_back(ep_moves[i].time), i += 2;
+			break;
+		default:
+			for (const move& mv : ep_moves) res.push_back(mv.time);
+			break;
+		}
+		return res;
+	}
+
 	std::vector<action> actions(unsigned who = -1u) const {
 		std::vector<action> res;
 		size_t i = 9;
@@ -98,13 +146,12 @@ public:
 public:
 
 	friend std::ostream& operator <<(std::ostream& out, const episode& ep) {
-		out << ep.ep_open << '|';
-		for (const move& mv : ep.ep_moves) out << mv;
-		out << '|' << ep.ep_close;
-		return out;
+		std::string buf;
+		ep.encode(buf);
+		return out.write(buf.data(), buf.size());
 	}
 	friend std::istream& operator >>(std::istream& in, episode& ep) {
-		ep = {};
+		ep.reset();
 		std::string token;
 		std::getline(in, token, '|');
 		std::stringstream(token) >> ep.ep_open;
@@ -119,8 +166,131 @@ public:
 		return in;
 	}
 
+	/**
+	 * append the episode in the text format to a buffer, i.e., the same bytes as operator <<,
+	 * so that many episodes can be written as a large block
+	 */
+	void encode(std::string& buf) const {
+		text::put(buf, ep_open);
+		buf.push_back('|');
+		for (const move& mv : ep_moves) text::put(buf, mv);
+		buf.push_back('|');
+		text::put(buf, ep_close);
+	}
+	/**
+	 * read an episode in the text format from a line without its newline, i.e., the same as operator >>
+	 * the line is parsed in place, or by operator >> if it is not exactly in the format written by encode
+	 */
+	void decode(const char* begin, const char* end) {
+		if (text::get(*this, begin, end)) return;
+		std::stringstream(std::string(begin, end)) >> *this;
+	}
+
+	/**
+	 * write the episode as a binary record, which is formatted as
+	 * (length:varint) (flags:1-byte) (open tag:string) (open time:varint) (close tag:string) (close time:varint)
+	 * (score:varint) (final tiles:8-byte) (final attr:varint) (#moves:varint) (moves)
+	 *
+	 * where a string is its length as a varint followed by its characters,
+	 * and each move is an action byte optionally followed by its reward and time as varints (see flags),
+	 * where the time is in nanoseconds if flag nanosec is set, or in milliseconds otherwise
+	 * an action byte is either
+	 * - a slide, 0x30 | opcode
+	 * - a place, position | (tile - 1) << 4 | (hint - 1) << 6, for tiles and hints within 1 to 3
+	 * - an escape 0x3f, followed by the full action code as a varint
+	 */
+	std::ostream& write(std::ostream& out) const {
+		unsigned flags = 0;
+		for (const move& mv : ep_moves) flags |= (mv.reward ? record::reward : 0) | (mv.time ? record::time : 0);
+		if (flags & record::time) flags |= record::nanosec;
+
+		std::string buf;
+		buf.push_back(char(flags));
+		record::put(buf, ep_open.tag);
+		record::put(buf, ep_open.when);
+		record::put(buf, ep_close.tag);
+		record::put(buf, ep_close.when);
+		record::put(buf, ep_score);
+		uint64_t tiles = bitboard(ep_state).raw();
+		for (int i = 0; i < 8; i++) buf.push_back(char(tiles >> (8 * i)));
+		record::put(buf, ep_state.info());
+		record::put(buf, ep_moves.size());
+		for (const move& mv : ep_moves) {
+			unsigned code = record::encode(mv.code);
+			buf.push_back(char(code));
+			if (code == record::escape) record::put(buf, unsigned(mv.code));
+			if (flags & record::reward) record::put(buf, mv.reward);
+			if (flags & record::time) record::put(buf, mv.time);
+		}
+
+		std::string len;
+		record::put(len, buf.size());
+		out.write(len.data(), len.size());
+		return out.write(buf.data(), buf.size());
+	}
+
+	/**
+	 * the largest length of a binary record accepted by read, far beyond that of any real episode,
+	 * so that a corrupted length fails the read instead of allocating an arbitrary buffer
+	 */
+	enum { max_record = 64 << 20 };
+
+	/**
+	 * read an episode from a binary record, see write for the format
+	 * the moves are not replayed since the final state and the score are stored
+	 */
+	std::istream& read(std::istream& in) {
+		uint64_t len = 0;
+		unsigned byte = 0x80;
+		for (unsigned shift = 0; (byte & 0x80) && shift < 64; shift += 7) {
+			byte = in.get();
+			if (!in) return in;
+			len |= uint64_t(byte & 0x7f) << shift;
+		}
+		if ((byte & 0x80) || len > max_record) {
+			in.setstate(std::ios::failbit);
+			return in;
+		}
+		std::string buf(len, '\0');
+		if (!in.read(&buf[0], len)) return in;
+
+		reset();
+		const char* it = buf.data();
+		const char* end = it + buf.size();
+		uint64_t flags = 0, score = 0, attr = 0, tiles = 0, num = 0;
+		bool ok = it != end;
+		if (ok) flags = uint8_t(*it++);
+		ok = ok && record::get(it, end, ep_open.tag) && record::get(it, end, ep_open.when);
+		ok = ok && record::get(it, end, ep_close.tag) && record::get(it, end, ep_close.when);
+		ok = ok && record::get(it, end, score) && end - it >= 8;
+		for (int i = 0; ok && i < 8; i++) tiles |= uint64_t(uint8_t(*it++)) << (8 * i);
+		ok = ok && record::get(it, end, attr) && record::get(it, end, num);
+		for (uint64_t i = 0; ok && i < num; i++) {
+			ok = it != end;
+			if (!ok) break;
+			unsigned code = uint8_t(*it++);
+			uint64_t full = 0, gain = 0, spent = 0;
+			if (code == record::escape) ok = record::get(it, end, full);
+			if (flags & record::reward) ok = ok && record::get(it, end, gain);
+			if (flags & record::time) ok = ok && record::get(it, end, spent);
+			action a = code == record::escape ? action(full) : record::decode(code);
+			if (!(flags & record::nanosec)) spent *= 1000000;
+			ep_moves.emplace_back(a, board::reward(gain), time_t(spent));
+		}
+		if (!ok) {
+			in.setstate(std::ios::failbit);
+			return in;
+		}
+		ep_score = score;
+		ep_state = board(bitboard(tiles, attr));
+		return in;
+	}
+
 protected:
 
+	/**
+	 * a move with its reward and its time in nanoseconds, where the time is written in milliseconds
+	 */
 	struct move {
 		action code;
 		board::reward reward;
@@ -131,7 +301,7 @@ protected:
 		friend std::ostream& operator <<(std::ostream& out, const move& m) {
 			out << m.code;
 			if (m.reward) out << '[' << std::dec << m.reward << ']';
-			if (m.time) out << '(' << std::dec << m.time << ')';
+			if (m.time / 1000000) out << '(' << std::dec << (m.time / 1000000) << ')';
 			return out;
 		}
 		friend std::istream& operator >>(std::istream& in, move& m) {
@@ -147,6 +317,7 @@ protected:
 				in.ignore(1);
 				in >> std::dec >> m.time;
 				in.ignore(1);
+				m.time *= 1000000;
 			}
 			return in;
 		}
@@ -165,12 +336,187 @@ protected:
 		}
 	};
 
+	/**
+	 * the helpers of the text format, which work on buffers instead of streams
+	 */
+	struct text {
+		static void put(std::string& buf, int64_t v) {
+			char num[24], *it = num + sizeof(num);
+			uint64_t u = v < 0 ? 0 - uint64_t(v) : uint64_t(v);
+			do *--it = char('0' + u % 10); while (u /= 10);
+			if (v < 0) *--it = '-';
+			buf.append(it, num + sizeof(num));
+		}
+		static void put(std::string& buf, const meta& m) {
+			buf.append(m.tag).push_back('@');
+			put(buf, int64_t(m.when));
+		}
+		static void put(std::string& buf, const move& m) {
+			const char* idx = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ?";
+			action::place p(m.code);
+			switch (m.code.type()) {
+			case action::slide::type: buf.push_back('#'), buf.push_back(("URDL")[m.code.event() & 0b11]); break;
+			case action::place::type: buf.push_back(idx[p.position()]), buf.push_back(idx[p.tile()]), buf.push_back(idx[p.hint()]); break;
+			default:                  buf.append("??"); break;
+			}
+			if (m.reward) buf.push_back('['), put(buf, int64_t(m.reward)), buf.push_back(']');
+			if (m.time / 1000000) buf.push_back('('), put(buf, int64_t(m.time / 1000000)), buf.push_back(')');
+		}
+
+		/**
+		 * parse an episode, or return false if the line is not exactly in the written format
+		 */
+		static bool get(episode& ep, const char* it, const char* end) {
+			ep.reset();
+			const char* bar = std::find(it, end, '|');
+			if (bar == end || !get(it, bar, ep.ep_open)) return false;
+			it = bar + 1;
+			bar = std::find(it, end, '|');
+			if (bar == end || it == bar) return false;
+			while (it != bar) {
+				move mv;
+				if (!get(it, bar, mv)) return false;
+				ep.ep_moves.push_back(mv);
+				ep.ep_score += action(mv).apply(ep.ep_state);
+			}
+			return std::find(bar + 1, end, '|') == end && get(bar + 1, end, ep.ep_close);
+		}
+		static bool get(const char* it, const char* end, meta& m) {
+			const char* at = std::find(it, end, '@');
+			if (at == end) return false;
+			m.tag.assign(it, at);
+			int64_t when;
+			it = at + 1;
+			if (!get(it, end, when) || it != end) return false;
+			m.when = when;
+			return true;
+		}
+		static bool get(const char*& it, const char* end, move& m) {
+			if (*it == '#') {
+				const char* opc = "URDL";
+				unsigned oper = end - it >= 2 ? std::find(opc, opc + 4, it[1]) - opc : 4;
+				if (oper >= 4) return false;
+				m.code = action::slide(oper);
+				it += 2;
+			} else {
+				if (end - it < 3) return false;
+				unsigned pos = digit(it[0]), tile = digit(it[1]), hint = digit(it[2]);
+				if (pos >= 36 || tile >= 36 || hint >= 36) return false;
+				m.code = action::place(std::min(pos, 16u), tile, hint);
+				it += 3;
+			}
+			int64_t v;
+			if (it != end && *it == '[') {
+				if (!get(++it, end, v) || it == end || *it++ != ']') return false;
+				m.reward = board::reward(v);
+			}
+			if (it != end && *it == '(') {
+				if (!get(++it, end, v) || it == end || *it++ != ')') return false;
+				m.time = time_t(v) * 1000000;
+			}
+			return true;
+		}
+		static bool get(const char*& it, const char* end, int64_t& v) {
+			bool neg = it != end && *it == '-';
+			const char* num = it += neg;
+			uint64_t u = 0;
+			for (; it != end && *it >= '0' && *it <= '9' && it - num < 18; it++) u = u * 10 + (*it - '0');
+			v = neg ? -int64_t(u) : int64_t(u);
+			return it != num && (it == end || *it < '0' || *it > '9');
+		}
+		static unsigned digit(char ch) {
+			if (ch >= '0' && ch <= '9') return ch - '0';
+			if (ch >= 'A' && ch <= 'Z') return ch - 'A' + 10;
+			return -1u;
+		}
+	};
+
+	/**
+	 * the helpers of the binary record format
+	 */
+	struct record {
+		enum { reward = 0x01, time = 0x02, nanosec = 0x04 };
+		enum { escape = 0x3f };
+
+		static void put(std::string& buf, uint64_t v) {
+			for (; v >= 0x80; v >>= 7) buf.push_back(char(v | 0x80));
+			buf.push_back(char(v));
+		}
+		static void put(std::string& buf, const std::string& str) {
+			put(buf, str.size());
+			buf.append(str);
+		}
+		template<typename integer>
+		static bool get(const char*& it, const char* end, integer& v) {
+			uint64_t val = 0;
+			for (unsigned shift = 0; it != end && shift < 64; shift += 7) {
+				uint8_t byte = *it++;
+				val |= uint64_t(byte & 0x7f) << shift;
+				if (!(byte & 0x80)) return v = integer(val), true;
+			}
+			return false;
+		}
+		static bool get(const char*& it, const char* end, std::string& str) {
+			uint64_t len;
+			if (!get(it, end, len) || uint64_t(end - it) < len) return false;
+			str.assign(it, len);
+			it += len;
+			return true;
+		}
+
+		static unsigned encode(action a) {
+			if (a.type() == action::slide::type && a.event() < 4) return 0x30 | a.event();
+			action::place p(a);
+			if (a.type() == action::place::type && a.event() < 0x1000 && p.tile() - 1 < 3 && p.hint() - 1 < 3)
+				return p.position() | ((p.tile() - 1) << 4) | ((p.hint() - 1) << 6);
+			return escape;
+		}
+		static action decode(unsigned code) {
+			if ((code & 0x30) == 0x30) return action::slide(code & 0x03);
+			return action::place(code & 0x0f, ((code >> 4) & 0x03) + 1, ((code >> 6) & 0x03) + 1);
+		}
+	};
+
+public:
+	/**
+	 * a pool of move buffers recycled across episodes, so that playing an episode does not allocate
+	 * a new buffer reserves a capacity grown from the lengths of the episodes released to the pool
+	 */
+	class pool {
+	public:
+		pool(size_t length = 256, size_t spares = 16) : length(length), spares(spares) {}
+
+		std::vector<move> acquire() {
+			std::vector<move> buf;
+			if (free.size()) {
+				buf = std::move(free.back());
+				free.pop_back();
+			}
+			if (buf.capacity() < length) buf.reserve(length);
+			return buf;
+		}
+		void release(episode& ep) {
+			std::vector<move>& buf = ep.ep_moves;
+			length = std::max(length, buf.size() + buf.size() / 4);
+			if (buf.capacity() >= length && free.size() < spares) {
+				buf.clear();
+				free.push_back(std::move(buf));
+			}
+			buf = {};
+		}
+
+	private:
+		std::vector<std::vector<move>> free;
+		size_t length;
+		size_t spares;
+	};
+
+protected:
 	static board initial_state() {
 		return {};
 	}
 	static time_t millisec() {
-		auto now = std::chrono::system_clock::now().time_since_epoch();
-		return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+		return timer::millisec();
 	}
 
 private:
@@ -178,7 +524,11 @@ private:
 	board::score ep_score;
 	std::vector<move> ep_moves;
 	time_t ep_time;
+	time_t ep_begin; // the clock of the moves when the episode is opened and closed
+	time_t ep_end;
 
 	meta ep_open;
 	meta ep_close;
 };
+
+inline episode::episode(pool& buffers) : ep_state(initial_state()), ep_score(0), ep_moves(buffers.acquire()), ep_time(0), ep_begin(0), ep_end(0) {}
@@ -0,0 +1,215 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * ntuple.h: Feature extraction and evaluation of n-tuple networks
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <array>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <cstdint>
+#include "bitboard.h"
+#include "weight.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * n-tuple patterns with their 8 isomorphisms
+ *
+ * a pattern is written as its cell indices in hex, and the patterns are separated by commas,
+ * e.g., "0123,4567" for the outer row and the inner row
+ * the feature of a pattern is the tile indices of its cells, with the first cell as the lowest nibble,
+ * so that a n-tuple pattern indexes a weight table of 16^n entries
+ *
+ * all features of a board are extracted in a batch, feature (i * 8 + k) is pattern (i) on isomorphism (k),
+ * and the weights are gathered and summed with AVX2 if available
+ */
+class ntuple {
+public:
+	enum { max_patterns = 32, max_length = 7 };
+
+	ntuple(const std::string& patterns = "0123,4567,0145,1256,569a,0124,1235,0156") {
+		std::string res = patterns;
+		for (char& ch : res)
+			if (!std::isxdigit(ch)) ch = ' ';
+		std::stringstream in(res);
+		for (std::string tuple; in >> tuple; ) {
+			if (tuple.size() > max_length || shifts.size() >= max_patterns)
+				throw std::invalid_argument("unsupported n-tuple pattern: " + patterns);
+			std::vector<unsigned> shift;
+			for (char ch : tuple) shift.push_back(4 * std::stoul(std::string(1, ch), nullptr, 16));
+			shifts.push_back(shift);
+		}
+	}
+
+public:
+	size_t size() const { return shifts.size(); }
+	size_t length(size_t i) const { return shifts[i].size(); }
+	size_t features() const { return size() * 8; }
+
+	/**
+	 * check whether a network has one table of matched size per pattern
+	 */
+	bool match(const std::vector<weight>& net) const {
+		return net.size() == size() && match(net.data());
+	}
+	template<typename value_t>
+	bool match(const basic_weight<value_t>* net) const {
+		for (size_t i = 0; i < size(); i++)
+			if (net[i].size() != (size_t(1) << (4 * length(i)))) return false;
+		return true;
+	}
+
+	/**
+	 * extract the features of all patterns and isomorphisms, index (i * 8 + k) for pattern (i) on isomorphism (k)
+	 */
+	void indices(const bitboard& b, uint32_t* idx) const {
+		std::array<bitboard, 8> iso;
+		b.isomorphisms(iso);
+#if defined(__AVX2__)
+		const __m256i mask = _mm256_set1_epi64x(0x0f);
+		const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+		__m256i lo = _mm256_setr_epi64x(iso[0].raw(), iso[1].raw(), iso[2].raw(), iso[3].raw());
+		__m256i hi = _mm256_setr_epi64x(iso[4].raw(), iso[5].raw(), iso[6].raw(), iso[7].raw());
+		for (size_t i = 0; i < size(); i++) {
+			__m256i id0 = _mm256_setzero_si256(), id1 = _mm256_setzero_si256();
+			for (size_t n = 0; n < shifts[i].size(); n++) {
+				__m128i shr = _mm_cvtsi32_si128(shifts[i][n]), shl = _mm_cvtsi32_si128(4 * n);
+				id0 = _mm256_or_si256(id0, _mm256_sll_epi64(_mm256_and_si256(_mm256_srl_epi64(lo, shr), mask), shl));
+				id1 = _mm256_or_si256(id1, _mm256_sll_epi64(_mm256_and_si256(_mm256_srl_epi64(hi, shr), mask), shl));
+			}
+			id0 = _mm256_permutevar8x32_epi32(id0, pack);
+			id1 = _mm256_permutevar8x32_epi32(id1, pack);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(idx + i * 8), _mm256_permute2x128_si256(id0, id1, 0x20));
+		}
+#else
+		for (size_t i = 0; i < size(); i++) {
+			for (size_t k = 0; k < 8; k++) {
+				uint64_t raw = iso[k].raw();
+				uint32_t index = 0;
+				for (size_t n = 0; n < shifts[i].size(); n++)
+					index |= ((raw >> shifts[i][n]) & 0x0fu) << (4 * n);
+				idx[i * 8 + k] = index;
+			}
+		}
+#endif
+	}
+
+	/**
+	 * estimate the value of a board, i.e., the sum of weights of all features
+	 * the network is either a vector of tables, or a pointer to the first table of the patterns
+	 */
+	float estimate(const bitboard& b, const std::vector<weight>& net) const {
+		return estimate(b, net.data());
+	}
+	template<typename value_t>
+	float estimate(const bitboard& b, const basic_weight<value_t>* net) const {
+		uint32_t idx[max_patterns * 8];
+		indices(b, idx);
+		return estimate(idx, net);
+	}
+	float estimate(const uint32_t* idx, const std::vector<weight>& net) const {
+		return estimate(idx, net.data());
+	}
+	float estimate(const uint32_t* idx, const weight* net) const {
+#if defined(__AVX2__)
+		__m256 sum = _mm256_setzero_ps();
+		for (size_t i = 0; i < size(); i++) {
+			__m256i id = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx + i * 8));
+			sum = _mm256_add_ps(sum, _mm256_i32gather_ps(&net[i][0], id, sizeof(float)));
+		}
+		__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+		half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+		half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 0x1));
+		return _mm_cvtss_f32(half);
+#else
+		float sum = 0;
+		for (size_t i = 0; i < size(); i++)
+			for (size_t k = 0; k < 8; k++) sum += net[i][idx[i * 8 + k]];
+		return sum;
+#endif
+	}
+	/**
+	 * the sum of weights of fixed-point tables, which is not scaled yet
+	 * the 16-bit weights are gathered as 32-bit words, so a table should be followed by at least 2 readable bytes
+	 */
+	float estimate(const uint32_t* idx, const basic_weight<int16_t>* net) const {
+#if defined(__AVX2__)
+		__m256i sum = _mm256_setzero_si256();
+		for (size_t i = 0; i < size(); i++) {
+			__m256i id = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx + i * 8));
+			__m256i w = _mm256_i32gather_epi32(reinterpret_cast<const int*>(&net[i][0]), id, sizeof(int16_t));
+			sum = _mm256_add_epi32(sum, _mm256_srai_epi32(_mm256_slli_epi32(w, 16), 16));
+		}
+		__m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+		half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+		half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+		return float(_mm_cvtsi128_si32(half));
+#else
+		int32_t sum = 0;
+		for (size_t i = 0; i < size(); i++)
+			for (size_t k = 0; k < 8; k++) sum += net[i][idx[i * 8 + k]];
+		return float(sum);
+#endif
+	}
+	/**
+	 * the sum of weights of bfloat16 tables, which are gathered in the same way as the fixed-point tables
+	 */
+	float estimate(const uint32_t* idx, const basic_weight<bfloat16>* net) const {
+#if defined(__AVX2__)
+		__m256 sum = _mm256_setzero_ps();
+		for (size_t i = 0; i < size(); i++) {
+			__m256i id = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(idx + i * 8));
+			__m256i w = _mm256_i32gather_epi32(reinterpret_cast<const int*>(&net[i][0]), id, sizeof(bfloat16));
+			sum = _mm256_add_ps(sum, _mm256_castsi256_ps(_mm256_slli_epi32(w, 16)));
+		}
+		__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+		half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+		half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 0x1));
+		return _mm_cvtss_f32(half);
+#else
+		float sum = 0;
+		for (size_t i = 0; i < size(); i++)
+			for (size_t k = 0; k < 8; k++) sum += net[i][idx[i * 8 + k]];
+		return sum;
+#endif
+	}
+
+	/**
+	 * prefetch the weights of the extracted features, so that the lookups of a batch of boards overlap
+	 */
+	template<typename value_t>
+	void prefetch(const uint32_t* idx, const basic_weight<value_t>* net) const {
+		for (size_t i = 0; i < size(); i++)
+			for (size_t k = 0; k < 8; k++) __builtin_prefetch(&net[i][idx[i * 8 + k]]);
+	}
+
+	/**
+	 * update the weights of all features of a board by u
+	 */
+	void update(const bitboard& b, std::vector<weight>& net, float u) const {
+		update(b, net.data(), u);
+	}
+	void update(const bitboard& b, weight* net, float u) const {
+		uint32_t idx[max_patterns * 8];
+		indices(b, idx);
+		update(idx, net, u);
+	}
+	void update(const uint32_t* idx, std::vector<weight>& net, float u) const {
+		update(idx, net.data(), u);
+	}
+	void update(const uint32_t* idx, weight* net, float u) const {
+		for (size_t i = 0; i < size(); i++)
+			for (size_t k = 0; k < 8; k++) net[i].add(idx[i * 8 + k], u);
+	}
+
+private:
+	std::vector<std::vector<unsigned>> shifts; // the bit offsets of cells of each pattern
+};
@@ -0,0 +1,185 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * prng.h: Fast pseudo-random number generators with independent streams
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+
+/**
+ * splitmix64, also used to expand a seed into the states of other generators
+ * streams are seeded apart by a mixed stream number
+ */
+class splitmix {
+public:
+	typedef uint64_t result_type;
+
+	splitmix(uint64_t seed = 0, uint64_t stream = 0) { this->seed(seed, stream); }
+	void seed(uint64_t seed, uint64_t stream = 0) {
+		state = seed;
+		if (stream) state ^= splitmix(stream ^ 0x6a09e667f3bcc909ull)();
+	}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+	result_type operator()() {
+		uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+private:
+	uint64_t state;
+};
+
+/**
+ * xoshiro256**, where stream (n) starts 2^128 * n steps after stream 0 of the same seed
+ */
+class xoshiro256 {
+public:
+	typedef uint64_t result_type;
+
+	xoshiro256(uint64_t seed = 0, uint64_t stream = 0) { this->seed(seed, stream); }
+	void seed(uint64_t seed, uint64_t stream = 0) {
+		splitmix mix(seed);
+		for (uint64_t& x : s) x = mix();
+		while (stream--) jump();
+	}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+	result_type operator()() {
+		uint64_t result = rotl(s[1] * 5, 7) * 9;
+		uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+
+	/**
+	 * advance the state by 2^128 steps
+	 */
+	void jump() {
+		static const uint64_t poly[] = { 0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull, 0x39abdc4529b1661cull };
+		uint64_t t[4] = { 0, 0, 0, 0 };
+		for (uint64_t p : poly) {
+			for (int b = 0; b < 64; b++) {
+				if (p & (uint64_t(1) << b))
+					for (int i = 0; i < 4; i++) t[i] ^= s[i];
+				operator()();
+			}
+		}
+		for (int i = 0; i < 4; i++) s[i] = t[i];
+	}
+
+private:
+	static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+	uint64_t s[4];
+};
+
+/**
+ * pcg32 (XSH-RR), where each stream has its own increment
+ */
+class pcg32 {
+public:
+	typedef uint32_t result_type;
+
+	pcg32(uint64_t seed = 0, uint64_t stream = 0) { this->seed(seed, stream); }
+	void seed(uint64_t seed, uint64_t stream = 0) {
+		inc = (stream << 1) | 1u;
+		state = 0;
+		operator()();
+		state += splitmix(seed)();
+		operator()();
+	}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+	result_type operator()() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ull + inc;
+		uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+		uint32_t rot = old >> 59;
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+
+private:
+	uint64_t state;
+	uint64_t inc;
+};
+
+/**
+ * a generator selected by name, i.e., "xoshiro256", "pcg32", or "splitmix"
+ * it produces 32-bit outputs, and draws bounded integers without bias by Lemire's method
+ */
+class prng {
+public:
+	typedef uint32_t result_type;
+
+	prng(const std::string& name = "xoshiro256", uint64_t seed = 0, uint64_t stream = 0) : kind(select(name)) {
+		this->seed(seed, stream);
+	}
+	void seed(uint64_t seed, uint64_t stream = 0) {
+		switch (kind) {
+		case type::xoshiro256: x.seed(seed, stream); break;
+		case type::pcg32: p.seed(seed, stream); break;
+		case type::splitmix: m.seed(seed, stream); break;
+		}
+	}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return ~result_type(0); }
+	result_type operator()() {
+		switch (kind) {
+		case type::xoshiro256: return x() >> 32;
+		case type::pcg32: return p();
+		default: return m() >> 32;
+		}
+	}
+
+	/**
+	 * a uniformly random integer in [0, n), n > 0
+	 */
+	uint32_t below(uint32_t n) {
+		uint64_t m = uint64_t(operator()()) * n;
+		if (uint32_t(m) < n) {
+			uint32_t t = -n % n;
+			while (uint32_t(m) < t) m = uint64_t(operator()()) * n;
+		}
+		return m >> 32;
+	}
+
+	/**
+	 * shuffle a range by Fisher-Yates with bounded draws
+	 */
+	template<typename iterator>
+	void shuffle(iterator first, iterator last) {
+		for (uint32_t n = last - first; n > 1; n--)
+			std::swap(first[n - 1], first[below(n)]);
+	}
+
+private:
+	enum class type { xoshiro256, pcg32, splitmix };
+	static type select(const std::string& name) {
+		if (name == "xoshiro256") return type::xoshiro256;
+		if (name == "pcg32") return type::pcg32;
+		if (name == "splitmix") return type::splitmix;
+		throw std::invalid_argument("unknown random number generator: " + name);
+	}
+
+	type kind;
+	xoshiro256 x;
+	pcg32 p;
+	splitmix m;
+};
@@ -0,0 +1,149 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * profile.h: Opt-in counters of the hot paths, enabled by compiling with -DPROFILE
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+#if defined(PROFILE)
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+/**
+ * the events are counted by each thread, and merged when the statistics of a block are shown
+ * a timed event also accumulates the cycles within its scope, including the nested events in it
+ *
+ * PROFILE_SCOPE(profile::slide) times the rest of the enclosing scope as an event
+ * PROFILE_COUNT(profile::node, n) counts n occurrences of an event
+ * both expand to nothing unless PROFILE is defined
+ */
+#if defined(PROFILE)
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(event) profile::scope PROFILE_CONCAT(profile_scope_, __LINE__)(event)
+#define PROFILE_COUNT(event, n) profile::count(event, n)
+#else
+#define PROFILE_SCOPE(event)
+#define PROFILE_COUNT(event, n)
+#endif
+
+class profile {
+public:
+	enum event {
+		take_slide, take_place, apply, slide, place, // timed events
+		move, node, chance, child, tt_hit, tt_miss, // counted events of search
+		events
+	};
+
+#if defined(PROFILE)
+	static void count(event e, uint64_t n = 1) { add(local().calls[e], n); }
+
+	class scope {
+	public:
+		scope(event e) : e(e), start(cycles()) {}
+		~scope() {
+			counters& c = local();
+			add(c.calls[e], 1);
+			add(c.cycles[e], cycles() - start);
+		}
+	private:
+		event e;
+		uint64_t start;
+	};
+
+	/**
+	 * print the events since the last call, merged from all threads, e.g.,
+	 *         take_slide      51227 calls     2345 cycles/call
+	 *         search          1234 nodes/move, branching = 2.7, tt hit = 45.3%
+	 */
+	static void show(std::ostream& out = std::cout) {
+		static const char* name[] = { "take_slide", "take_place", "apply", "slide", "place" };
+		static uint64_t last_calls[events], last_cycles[events];
+		uint64_t calls[events] = {}, cycles[events] = {};
+		{
+			std::lock_guard<std::mutex> guard(registry().lock);
+			for (const counters& c : registry().threads) {
+				for (int e = 0; e < events; e++) {
+					calls[e] += c.calls[e].load(std::memory_order_relaxed);
+					cycles[e] += c.cycles[e].load(std::memory_order_relaxed);
+				}
+			}
+		}
+		for (int e = 0; e < events; e++) {
+			std::swap(calls[e], last_calls[e]), calls[e] = last_calls[e] - calls[e];
+			std::swap(cycles[e], last_cycles[e]), cycles[e] = last_cycles[e] - cycles[e];
+		}
+
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed << std::setprecision(0);
+		for (int e = take_slide; e <= place; e++) {
+			if (calls[e] == 0) continue;
+			out << "\t" << name[e] << "\t" << calls[e] << " calls\t" << (cycles[e] / double(calls[e])) << " cycles/call" << std::endl;
+		}
+		if (calls[move]) {
+			out << std::setprecision(1);
+			out << "\t" "search\t" << ((calls[node] + calls[chance]) / double(calls[move])) << " nodes/move, ";
+			out << "branching = " << (calls[node] ? calls[child] / double(calls[node]) : 0) << ", ";
+			out << "tt hit = " << (calls[tt_hit] * 100.0 / std::max<uint64_t>(calls[tt_hit] + calls[tt_miss], 1)) << "%" << std::endl;
+		}
+		out.copyfmt(ff);
+	}
+
+private:
+	struct counters {
+		std::atomic<uint64_t> calls[events], cycles[events];
+		counters() {
+			for (int e = 0; e < events; e++) calls[e] = 0, cycles[e] = 0;
+		}
+	};
+
+	/**
+	 * the counters of all threads, which outlive the threads so that they can be merged at any time
+	 */
+	struct registry_t {
+		std::mutex lock;
+		std::deque<counters> threads;
+	};
+	static registry_t& registry() { static registry_t reg; return reg; }
+
+	static counters& local() {
+		static thread_local counters* mine = nullptr;
+		if (!mine) {
+			std::lock_guard<std::mutex> guard(registry().lock);
+			registry().threads.emplace_back();
+			mine = &registry().threads.back();
+		}
+		return *mine;
+	}
+
+	/**
+	 * add to a counter of the current thread, which is only written by this thread
+	 */
+	static void add(std::atomic<uint64_t>& c, uint64_t n) {
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	static uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+	}
+#else
+	static void show(std::ostream& out = std::cout) {}
+#endif
+};
@@ -0,0 +1,283 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * replay.h: Streaming analysis of saved episodes
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "episode.h"
+#include "statistics.h"
+
+/**
+ * the analysis of a file saved by statistics::save, in either the text format or the binary format
+ *
+ * the file is read by the calling thread in batches of records, which are decoded and accumulated by the threads,
+ * so only a few batches are in memory at any time regardless of the size of the file
+ * besides the summary of --load, it shows the statistics of each block, and the quantiles of the scores
+ * and of the move times of both agents, which are kept in histograms of a fixed size
+ */
+class replay {
+public:
+	replay(size_t block = 0, size_t threads = 1) : block(block), threads(std::max<size_t>(threads, 1)), count(0), finished(false) {}
+
+	/**
+	 * read and accumulate all episodes of a file
+	 */
+	void run(std::istream& in) {
+		std::string head(statistics::magic().size(), '\0');
+		auto pos = in.tellg();
+		bool binary = in.read(&head[0], head.size()) && head == statistics::magic();
+		if (!binary) {
+			in.clear();
+			in.seekg(pos);
+		}
+
+		std::vector<std::thread> workers;
+		for (size_t id = 0; id < threads; id++) workers.emplace_back(&replay::work, this, binary);
+		size_t index = 0;
+		for (batch next; binary ? read_records(in, next) : read_lines(in, next); next = batch()) {
+			next.first = index;
+			index += next.num;
+			std::unique_lock<std::mutex> guard(lock);
+			space.wait(guard, [this]() { return queue.size() < 2 * threads; });
+			queue.push_back(std::move(next));
+			ready.notify_one();
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			finished = true;
+		}
+		ready.notify_all();
+		for (std::thread& th : workers) th.join();
+	}
+
+	/**
+	 * show the statistics of each block, the summary, and the quantiles, e.g.,
+	 * 1000    avg = 282, max = 2325, ops = 1346086 (2840867|955796)
+	 *         6       100%    (0.9%)
+	 *         ...
+	 *
+	 *         score   p10 = 96, p25 = 171, p50 = 261, p75 = 360, p90 = 480, p99 = 888, max = 2325
+	 *         slide   p50 = 312ns, p90 = 391ns, p99 = 1.1us, p99.9 = 8.5us, max = 23us
+	 *         place   p50 = 254ns, p90 = 285ns, p99 = 572ns, p99.9 = 3.2us, max = 17us
+	 */
+	void show() const {
+		if (count == 0) return;
+		if (block && block < count) {
+			for (size_t b = 0; b < blocks.size(); b++) blocks[b].show(std::min((b + 1) * block, count), false);
+			std::cout << std::endl;
+		}
+		whole.show(count, true);
+
+		std::cout << "\t" "score\t";
+		for (double q : { 0.1, 0.25, 0.5, 0.75, 0.9, 0.99 })
+			std::cout << "p" << (q * 100) << " = " << scores.quantile(q) << ", ";
+		std::cout << "max = " << whole.max << std::endl;
+		for (int who : { action::slide::type, action::place::type }) {
+			const histogram& h = times[who == action::slide::type ? 0 : 1];
+			std::cout << "\t" << (who == action::slide::type ? "slide" : "place") << "\t";
+			for (double q : { 0.5, 0.9, 0.99, 0.999 })
+				std::cout << "p" << (q * 100) << " = " << duration(h.quantile(q)) << ", ";
+			std::cout << "max = " << duration(h.max()) << std::endl;
+		}
+		std::cout << std::endl;
+	}
+
+	size_t size() const { return count; }
+
+protected:
+	/**
+	 * a histogram of nonnegative integers with 64 buckets per power of two,
+	 * so that a quantile is accurate to about 1.6% with a fixed number of buckets, while the maximum is exact
+	 */
+	class histogram {
+	public:
+		histogram() : bins(59 * 64), num(0), top(0) {}
+		void add(uint64_t v) { bins[bucket(v)]++, num++, top = std::max(top, v); }
+		void merge(const histogram& h) {
+			for (size_t b = 0; b < bins.size(); b++) bins[b] += h.bins[b];
+			num += h.num;
+			top = std::max(top, h.top);
+		}
+		uint64_t max() const { return top; }
+		/**
+		 * the lower bound of the bucket of the value at quantile q, e.g., q = 0.5 for the median
+		 */
+		uint64_t quantile(double q) const {
+			uint64_t rank = std::min<uint64_t>(num ? q * (num - 1) : 0, num ? num - 1 : 0), seen = 0;
+			for (size_t b = 0; b < bins.size(); b++)
+				if ((seen += bins[b]) > rank) return lower(b);
+			return 0;
+		}
+
+	private:
+		static size_t bucket(uint64_t v) {
+			if (v < 64) return v;
+			unsigned e = 63 - __builtin_clzll(v);
+			return (e - 5) * 64 + ((v >> (e - 6)) & 63);
+		}
+		static uint64_t lower(size_t b) {
+			if (b < 64) return b;
+			return uint64_t(64 + b % 64) << (b / 64 - 1);
+		}
+
+	private:
+		std::vector<uint64_t> bins;
+		uint64_t num;
+		uint64_t top; // the exact maximum
+	};
+
+	/**
+	 * a batch of consecutive records, i.e., lines of the text format or records of the binary format
+	 */
+	struct batch {
+		std::string data;
+		size_t first; // the index of the first episode
+		size_t num;
+		batch() : first(0), num(0) {}
+	};
+
+	/**
+	 * the statistics accumulated by a thread
+	 */
+	struct part {
+		statistics::tally whole;
+		std::vector<statistics::tally> blocks;
+		histogram scores;
+		histogram times[2]; // of the slider and the placer
+	};
+
+	void work(bool binary) {
+		part mine;
+		while (true) {
+			batch next;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				ready.wait(guard, [this]() { return queue.size() || finished; });
+				if (queue.empty()) break;
+				next = std::move(queue.front());
+				queue.pop_front();
+			}
+			space.notify_one();
+
+			std::istringstream in(binary ? next.data : std::string());
+			const char* line = next.data.data();
+			const char* end = line + next.data.size();
+			episode rec;
+			for (size_t i = 0; i < next.num; i++) {
+				if (binary) {
+					if (!rec.read(in)) break;
+				} else {
+					const char* eol = std::find(line, end, '\n');
+					rec.decode(line, eol);
+					line = eol + (eol != end);
+				}
+				accumulate(mine, rec, next.first + i);
+			}
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		whole.merge(mine.whole);
+		if (blocks.size() < mine.blocks.size()) blocks.resize(mine.blocks.size());
+		for (size_t b = 0; b < mine.blocks.size(); b++) blocks[b].merge(mine.blocks[b]);
+		scores.merge(mine.scores);
+		times[0].merge(mine.times[0]);
+		times[1].merge(mine.times[1]);
+		count += mine.whole.num;
+	}
+
+	void accumulate(part& mine, const episode& rec, size_t index) {
+		mine.whole.add(rec);
+		if (block) {
+			size_t b = index / block;
+			if (mine.blocks.size() <= b) mine.blocks.resize(b + 1);
+			mine.blocks[b].add(rec);
+		}
+		mine.scores.add(rec.score());
+		for (time_t t : rec.times(action::slide::type)) mine.times[0].add(t);
+		for (time_t t : rec.times(action::place::type)) mine.times[1].add(t);
+	}
+
+	/**
+	 * read a batch of lines, or of about 1 MB, where an empty line ends the file as in statistics::load
+	 */
+	static bool read_lines(std::istream& in, batch& next) {
+		for (std::string line; next.num < 1024 && next.data.size() < (1 << 20) && std::getline(in, line); ) {
+			if (line.empty()) {
+				in.setstate(std::ios::eofbit);
+				break;
+			}
+			next.data.append(line).push_back('\n');
+			next.num++;
+		}
+		return next.num;
+	}
+	/**
+	 * read a batch of binary records, or of about 1 MB, where each record is kept with its length
+	 * the file ends at a record whose length is malformed or exceeds episode::max_record
+	 */
+	static bool read_records(std::istream& in, batch& next) {
+		while (next.num < 1024 && next.data.size() < (1 << 20)) {
+			uint64_t len = 0;
+			size_t begin = next.data.size();
+			unsigned byte = 0x80;
+			for (unsigned shift = 0; (byte & 0x80) && shift < 64; shift += 7) {
+				byte = in.get();
+				if (!in) break;
+				next.data.push_back(char(byte));
+				len |= uint64_t(byte & 0x7f) << shift;
+			}
+			if (in && ((byte & 0x80) || len > episode::max_record)) in.setstate(std::ios::failbit);
+			if (!in) {
+				next.data.resize(begin);
+				break;
+			}
+			size_t at = next.data.size();
+			next.data.resize(at + len);
+			if (!in.read(&next.data[at], len)) {
+				next.data.resize(begin);
+				break;
+			}
+			next.num++;
+		}
+		return next.num;
+	}
+
+	static std::string duration(uint64_t ns) {
+		std::stringstream out;
+		out << std::setprecision(3);
+		if (ns < 1000) out << ns << "ns";
+		else if (ns < 1000000) out << (ns / 1e3) << "us";
+		else if (ns < 1000000000) out << (ns / 1e6) << "ms";
+		else out << (ns / 1e9) << "s";
+		return out.str();
+	}
+
+private:
+	size_t block;
+	size_t threads;
+	size_t count;
+	std::mutex lock;
+	std::condition_variable ready; // the queue has a batch or the file is finished
+	std::condition_variable space; // the queue has room for another batch
+	std::deque<batch> queue;
+	bool finished;
+	statistics::tally whole;
+	std::vector<statistics::tally> blocks;
+	histogram scores;
+	histogram times[2];
+};
@@ -15,6 +15,7 @@
 #include "board.h"
 #include "action.h"
 #include "episode.h"
+#include "profile.h"
 
 class statistics {
 public:
@@ -23,13 +24,18 @@ public:
 	 * the block size of statistics
 	 * the limit of saving records
 	 *
+	 * whether to retain the records
+	 *
 	 * note that total >= limit >= block
+	 * the statistics are accumulated when each episode is closed, so the records are
+	 * only needed for saving; if 'retain' is unset, no finished episode is kept
 	 */
-	statistics(size_t total, size_t block = 0, size_t limit = 0)
+	statistics(size_t total, size_t block = 0, size_t limit = 0, bool retain = true)
 		: total(total),
 		  block(block ? block : total),
 		  limit(limit ? limit : total),
-		  count(0) {}
+		  count(0),
+		  retain(retain) {}
 
 public:
 	/**
@@ -55,50 +61,17 @@ public:
 	 */
 	void show(bool tstat = true, size_t blk = 0) const {
 		size_t num = std::min(data.size(), blk ?: block);
-		size_t stat[64] = { 0 };
-		size_t sop = 0, pop = 0, eop = 0;
-		time_t sdu = 0, pdu = 0, edu = 0;
-		board::score sum = 0, max = 0;
+		tally stat;
 		auto it = data.end();
-		for (size_t i = 0; i < num; i++) {
-			auto& ep = *(--it);
-			sum += ep.score();
-			max = std::max(ep.score(), max);
-			stat[*std::max_element(ep.state().begin(), ep.state().end())]++;
-			sop += ep.step();
-			pop += ep.step(action::slide::type);
-			eop += ep.step(action::place::type);
-			sdu += ep.time();
-			pdu += ep.time(action::slide::type);
-			edu += ep.time(action::place::type);
-		}
-
-		std::ios ff(nullptr);
-		ff.copyfmt(std::cout);
-		std::cout << std::fixed << std::setprecision(0);
-		std::cout << count << "\t";
-		std::cout << "avg = " << (sum / num) << ", ";
-		std::cout << "max = " << (max) << ", ";
-		std::cout << "ops = " << (sop * 1000.0 / sdu);
-		std::cout <<     " (" << (pop * 1000.0 / pdu);
-		std::cout <<      "|" << (eop * 1000.0 / edu) << ")";
-		std::cout << std::endl;
-		std::cout.copyfmt(ff);
-
-		if (!tstat) return;
-		for (size_t t = 0, c = 0; c < num; c += stat[t++]) {
-			if (stat[t] == 0) continue;
-			size_t accu = std::accumulate(std::begin(stat) + t, std::end(stat), size_t(0));
-			std::cout << "\t" << board::itot(t); // type
-			std::cout << "\t" << (accu * 100.0 / num) << "%"; // win rate
-			std::cout << "\t" "(" << (stat[t] * 100.0 / num) << "%" ")"; // percentage of ending
-			std::cout << std::endl;
-		}
-		std::cout << std::endl;
+		for (size_t i = 0; i < num; i++) stat.add(*(--it));
+		stat.show(count, tstat);
 	}
 
+	/**
+	 * show the statistics of all episodes, including those that are no longer kept
+	 */
 	void summary() const {
-		show(true, data.size());
+		whole.show(count, true);
 	}
 
 	bool is_finished() const {
@@ -106,14 +79,35 @@ public:
 	}
 
 	void open_episode(const std::string& flag = "") {
-		if (count++ >= limit) data.pop_front();
-		data.emplace_back();
+		if (!retain) evict(data.size());
+		else if (count >= limit) evict(1);
+		count++;
+		data.emplace_back(moves);
 		data.back().open_episode(flag);
 	}
 
 	void close_episode(const std::string& flag = "") {
 		data.back().close_episode(flag);
-		if (count % block == 0) show();
+		accumulate(data.back());
+	}
+
+	/**
+	 * append an episode which has been played elsewhere, e.g., by a worker thread
+	 * the episode should be finished, i.e., both opened and closed
+	 */
+	void push_episode(episode&& ep) {
+		count++;
+		accumulate(ep);
+		if (!retain) return moves.release(ep);
+		if (count > limit) evict(1);
+		data.push_back(std::move(ep));
+	}
+
+	/**
+	 * an empty episode whose move buffer is recycled from the evicted episodes
+	 */
+	episode spare() {
+		return episode(moves);
 	}
 
 	episode& at(size_t i) {
@@ -129,24 +123,168 @@ public:
 		return count;
 	}
 
-	friend std::ostream& operator <<(std::ostream& out, const statistics& stat) {
-		for (const episode& rec : stat.data) out << rec << std::endl;
+	/**
+	 * save the episodes in either the text format or the binary format
+	 * the binary format begins with the magic "TCGB" and a version byte, followed by the records of episode::write
+	 */
+	std::ostream& save(std::ostream& out, bool binary = false) const {
+		if (!binary) {
+			std::string buf;
+			for (const episode& rec : data) {
+				rec.encode(buf);
+				buf.push_back('\n');
+				if (buf.size() < (1 << 20)) continue;
+				out.write(buf.data(), buf.size());
+				buf.clear();
+			}
+			return out.write(buf.data(), buf.size());
+		}
+		out.write(magic().data(), magic().size());
+		for (const episode& rec : data) rec.write(out);
 		return out;
 	}
-	friend std::istream& operator >>(std::istream& in, statistics& stat) {
-		for (std::string line; std::getline(in, line) && line.size(); ) {
-			stat.data.emplace_back();
-			std::stringstream(line) >> stat.data.back();
+
+	/**
+	 * load the episodes from either the text format or the binary format, one episode at a time
+	 * all episodes are kept if the records are retained, while the summary always covers all of them
+	 */
+	std::istream& load(std::istream& in) {
+		std::string head(magic().size(), '\0');
+		auto pos = in.tellg();
+		bool binary = in.read(&head[0], head.size()) && head == magic();
+		if (!binary) {
+			in.clear();
+			in.seekg(pos);
 		}
-		stat.total = std::max(stat.total, stat.data.size());
-		stat.count = stat.data.size();
+		std::string line;
+		for (episode rec(moves); binary ? bool(rec.read(in)) : read_line(in, line, rec); ) {
+			count++;
+			whole.add(rec);
+			recent.add(rec);
+			if (block && count % block == 0) recent = {};
+			if (!retain) continue;
+			// a retained episode keeps its buffer, so the next one is read into a buffer of the pool,
+			// which is reserved for a whole episode instead of growing from empty
+			data.push_back(std::move(rec));
+			rec = spare();
+		}
+		total = std::max(total, count);
 		return in;
 	}
 
+	friend std::ostream& operator <<(std::ostream& out, const statistics& stat) {
+		return stat.save(out);
+	}
+	friend std::istream& operator >>(std::istream& in, statistics& stat) {
+		return stat.load(in);
+	}
+	friend class replay;
+
+protected:
+	/**
+	 * the accumulated statistics of a set of episodes, see show for the format
+	 */
+	struct tally {
+		size_t num, stat[64];
+		size_t sop, pop, eop;
+		time_t sdu, pdu, edu;
+		board::score sum, max;
+		tally() : num(0), stat(), sop(0), pop(0), eop(0), sdu(0), pdu(0), edu(0), sum(0), max(0) {}
+
+		void add(const episode& ep) {
+			num++;
+			sum += ep.score();
+			max = std::max(ep.score(), max);
+			stat[*std::max_element(ep.state().begin(), ep.state().end())]++;
+			sop += ep.step();
+			pop += ep.step(action::slide::type);
+			eop += ep.step(action::place::type);
+			sdu += ep.time();
+			pdu += ep.time(action::slide::type);
+			edu += ep.time(action::place::type);
+		}
+		void merge(const tally& t) {
+			num += t.num;
+			for (size_t i = 0; i < 64; i++) stat[i] += t.stat[i];
+			sop += t.sop, pop += t.pop, eop += t.eop;
+			sdu += t.sdu, pdu += t.pdu, edu += t.edu;
+			sum += t.sum;
+			max = std::max(max, t.max);
+		}
+
+		void show(size_t index, bool tstat = true) const {
+			if (num == 0) {
+				std::cout << index << "\t" "no episodes" << std::endl << std::endl;
+				return;
+			}
+			// the speed is shown as 0 if the operations took no measurable time
+			auto rate = [](size_t ops, time_t du) -> double { return du ? ops * 1e9 / du : 0; };
+			std::ios ff(nullptr);
+			ff.copyfmt(std::cout);
+			std::cout << std::fixed << std::setprecision(0);
+			std::cout << index << "\t";
+			std::cout << "avg = " << (sum / num) << ", ";
+			std::cout << "max = " << (max) << ", ";
+			std::cout << "ops = " << rate(sop, sdu);
+			std::cout <<     " (" << rate(pop, pdu);
+			std::cout <<      "|" << rate(eop, edu) << ")";
+			std::cout << std::endl;
+			std::cout.copyfmt(ff);
+			profile::show();
+
+			if (!tstat) return;
+			for (size_t t = 0, c = 0; c < num; c += stat[t++]) {
+				if (stat[t] == 0) continue;
+				size_t accu = std::accumulate(std::begin(stat) + t, std::end(stat), size_t(0));
+				std::cout << "\t" << board::itot(t); // type
+				std::cout << "\t" << (accu * 100.0 / num) << "%"; // win rate
+				std::cout << "\t" "(" << (stat[t] * 100.0 / num) << "%" ")"; // percentage of ending
+				std::cout << std::endl;
+			}
+			std::cout << std::endl;
+		}
+	};
+
+	/**
+	 * drop the oldest episodes, and return their move buffers to the pool
+	 */
+	void evict(size_t num) {
+		for (size_t i = 0; i < num; i++) {
+			moves.release(data.front());
+			data.pop_front();
+		}
+	}
+
+	/**
+	 * accumulate a closed episode, and show the statistics at the end of each block
+	 */
+	void accumulate(const episode& ep) {
+		whole.add(ep);
+		recent.add(ep);
+		if (count % block) return;
+		recent.show(count);
+		recent = {};
+	}
+
+	static bool read_line(std::istream& in, std::string& line, episode& rec) {
+		if (!std::getline(in, line) || line.empty()) return false;
+		rec.decode(line.data(), line.data() + line.size());
+		return true;
+	}
+
+	static const std::string& magic() {
+		static const std::string head("TCGB\x01", 5);
+		return head;
+	}
+
 private:
 	size_t total;
 	size_t block;
 	size_t limit;
 	size_t count;
+	bool retain;
 	std::deque<episode> data;
+	episode::pool moves;
+	tally whole; // all episodes
+	tally recent; // the episodes of the current block
 };
@@ -0,0 +1,143 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * threadpool.h: Work-stealing thread pool for splitting a single decision
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <map>
+
+/**
+ * a pool of threads which run the tasks of a batch, where a task is identified by its index in the batch
+ *
+ * the tasks are dealt round-robin to the queues of the threads, including the calling thread;
+ * each thread takes tasks from the back of its own queue, and steals from the front of the others
+ * when its own queue is empty, so that a batch of uneven tasks still keeps all threads busy
+ *
+ * a batch is run by one caller at a time, which returns after all tasks of the batch are finished;
+ * the batches of concurrent callers, e.g., the agents of different threads sharing a pool, are run in turn
+ */
+class threadpool {
+public:
+	threadpool(size_t threads = std::thread::hardware_concurrency())
+		: queues(std::max<size_t>(threads, 1)), job(nullptr), queued(0), pending(0), stop(false) {
+		for (size_t id = 1; id < queues.size(); id++)
+			workers.emplace_back(&threadpool::work, this, id);
+	}
+	~threadpool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stop = true;
+		}
+		wake.notify_all();
+		for (std::thread& th : workers) th.join();
+	}
+
+	size_t size() const { return queues.size(); }
+
+	/**
+	 * the pool of the given size shared by all its holders in the process, e.g., the agents of all threads
+	 * so that the threads of the pools do not multiply with the agents; the pool is released with its last holder
+	 */
+	static std::shared_ptr<threadpool> shared(size_t threads) {
+		static std::mutex lock;
+		static std::map<size_t, std::weak_ptr<threadpool>> pools;
+		std::lock_guard<std::mutex> guard(lock);
+		std::shared_ptr<threadpool> pool = pools[threads].lock();
+		if (!pool) pools[threads] = pool = std::make_shared<threadpool>(threads);
+		return pool;
+	}
+
+	/**
+	 * run task(i) for all i in [0, num) on the threads, and wait until all of them are finished
+	 */
+	void run(size_t num, const std::function<void(size_t)>& task) {
+		if (num == 0) return;
+		std::lock_guard<std::mutex> turn(batch);
+		job = &task;
+		pending = num;
+		for (size_t i = 0; i < num; i++) {
+			queue& q = queues[i % size()];
+			std::lock_guard<std::mutex> guard(q.lock);
+			q.tasks.push_back(i);
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			queued += num;
+		}
+		wake.notify_all();
+		while (pending) {
+			size_t i;
+			if (take(0, i)) execute(i);
+			else std::this_thread::yield();
+		}
+		job = nullptr;
+	}
+
+private:
+	struct queue {
+		std::mutex lock;
+		std::deque<size_t> tasks;
+	};
+
+	/**
+	 * take a task from the back of the own queue, or steal one from the front of another queue
+	 */
+	bool take(size_t id, size_t& task) {
+		for (size_t n = 0; n < size(); n++) {
+			queue& q = queues[(id + n) % size()];
+			std::lock_guard<std::mutex> guard(q.lock);
+			if (q.tasks.empty()) continue;
+			if (n == 0) {
+				task = q.tasks.back();
+				q.tasks.pop_back();
+			} else {
+				task = q.tasks.front();
+				q.tasks.pop_front();
+			}
+			queued--;
+			return true;
+		}
+		return false;
+	}
+
+	void execute(size_t task) {
+		(*job)(task);
+		pending--;
+	}
+
+	void work(size_t id) {
+		while (true) {
+			size_t task;
+			if (take(id, task)) {
+				execute(task);
+				continue;
+			}
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this]() { return stop || queued > 0; });
+			if (stop) return;
+		}
+	}
+
+private:
+	std::vector<queue> queues;
+	std::vector<std::thread> workers;
+	const std::function<void(size_t)>* job;
+	std::atomic<size_t> queued; // the tasks in the queues
+	std::atomic<size_t> pending; // the tasks not finished yet
+	std::mutex lock;
+	std::condition_variable wake;
+	std::mutex batch; // held by the caller whose batch is running
+	bool stop;
+};
@@ -10,21 +10,63 @@
 #include <iostream>
 #include <fstream>
 #include <iterator>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <memory>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
 #include "statistics.h"
+#include "replay.h"
+#include "timer.h"
+#include "profile.h"
+
+/**
+ * play an episode with the given slider and placer
+ * return the agent who takes the last turn, i.e., the winner
+ */
+agent& play_episode(episode& game, agent& slide, agent& place) {
+	while (true) {
+		agent& who = game.take_turns(slide, place);
+		action move;
+		{
+			PROFILE_SCOPE(&who == &slide ? profile::take_slide : profile::take_place);
+			move = who.take_action(game.state());
+		}
+//		std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
+		if (game.apply_action(move) != true) break;
+		if (who.check_for_win(game.state())) break;
+	}
+	return game.last_turns(slide, place);
+}
+
+/**
+ * create a slider by its name, e.g., --slide="name=expectimax depth=3"
+ * the original random_slider_2 is used if the name is not recognized
+ */
+std::unique_ptr<agent> make_slider(const std::string& args) {
+	std::string name = agent(args).name();
+	if (name == "expectimax") return std::unique_ptr<agent>(new expectimax_slider(args));
+	if (name == "td") return std::unique_ptr<agent>(new td_slider(args));
+	return std::unique_ptr<agent>(new random_slider_2(args));
+}
 
 int main(int argc, const char* argv[]) {
 	std::cout << "Threes! Demo: ";
 	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
 	std::cout << std::endl << std::endl;
 
-	size_t total = 1000, block = 0, limit = 0;
+	size_t total = 1000, block = 0, limit = 0, threads = 1;
+	size_t shard = 0, shards = 0; // --shard=i/N, or no shard
 	std::string slide_args, place_args;
-	std::string load_path, save_path;
+	std::string save_path, replay_path;
+	std::vector<std::string> load_paths, merge_paths;
 	for (int i = 1; i < argc; i++) {
 		std::string arg = argv[i];
 		auto match_arg = [&](std::string flag) -> bool {
@@ -41,46 +83,131 @@ int main(int argc, const char* argv[]) {
 			block = std::stoull(next_opt());
 		} else if (match_arg("limit")) {
 			limit = std::stoull(next_opt());
+		} else if (match_arg("threads")) {
+			threads = std::max(std::stoull(next_opt()), 1ull);
 		} else if (match_arg("slide") || match_arg("play")) {
 			slide_args = next_opt();
 		} else if (match_arg("place") || match_arg("env")) {
 			place_args = next_opt();
 		} else if (match_arg("load")) {
-			load_path = next_opt();
+			load_paths.assign(1, next_opt());
+		} else if (match_arg("merge")) {
+			std::stringstream in(next_opt());
+			merge_paths.clear();
+			for (std::string path; std::getline(in, path, ','); ) merge_paths.push_back(path);
+		} else if (match_arg("shard")) {
+			std::string opt = next_opt();
+			size_t split = opt.find('/');
+			auto number = [](const std::string& str) -> bool {
+				return str.size() && str.size() <= 18 && str.find_first_not_of("0123456789") == std::string::npos;
+			};
+			shard = shards = 0;
+			if (split != std::string::npos && number(opt.substr(0, split)) && number(opt.substr(split + 1))) {
+				shard = std::stoull(opt.substr(0, split));
+				shards = std::stoull(opt.substr(split + 1));
+			}
+			if (shard >= shards) {
+				std::cerr << "invalid shard: " << opt << ", expected --shard=i/N with 0 <= i < N" << std::endl;
+				return 1;
+			}
 		} else if (match_arg("save")) {
 			save_path = next_opt();
+		} else if (match_arg("replay")) {
+			replay_path = next_opt();
+		} else if (match_arg("timer")) {
+			timer::use(next_opt());
+		} else if (match_arg("sample")) {
+			timer::sample(std::stoul(next_opt()));
 		}
 	}
 
-	statistics stats(total, block, limit);
+	// with --merge, the files are loaded in order after those of --load, and no more episodes are played
+	if (merge_paths.size()) {
+		load_paths.insert(load_paths.end(), merge_paths.begin(), merge_paths.end());
+		total = 0;
+	}
+
+	if (replay_path.size()) {
+		std::ifstream in(replay_path, std::ios::in | std::ios::binary);
+		replay analysis(block, threads);
+		analysis.run(in);
+		analysis.show();
+		return 0;
+	}
+
+	// the random agents are reseeded by the global index of each episode, so the games of the same seeds
+	// do not depend on how the episodes are spread over the threads (--threads) or the processes (--shard);
+	// with --shard=i/N, only the episodes [total * i / N, total * (i + 1) / N) are played, and the shards
+	// merged in order by --merge are the same games as those of a single process
+	size_t first = shards ? total * shard / shards : 0;
+	if (shards) total = total * (shard + 1) / shards - first;
+
+	statistics stats(total, block, limit, save_path.size());
 
-	if (load_path.size()) {
-		std::ifstream in(load_path, std::ios::in);
-		in >> stats;
+	for (const std::string& load_path : load_paths) {
+		std::ifstream in(load_path, std::ios::in | std::ios::binary);
+		stats.load(in);
 		in.close();
-		if (stats.is_finished()) stats.summary();
 	}
+	if (load_paths.size() && stats.is_finished()) stats.summary();
 
-	random_slider_2 slide(slide_args); //player
-	
+	std::unique_ptr<agent> player = make_slider(slide_args);
+	agent& slide = *player;
 
 	random_placer place(place_args);
 
+	// with --threads, the episodes are played by the threads, each of which has its own agents;
+	// the sliders of the threads share the network of the slider above, e.g., for concurrent training,
+	// which is saved by the slider above after all threads are joined
+	if (threads > 1) {
+		std::mutex lock;
+		std::map<size_t, episode> done; // finished episodes waiting for their turn
+		std::atomic<size_t> issue(stats.step());
+		auto worker = [&]() {
+			std::unique_ptr<agent> player = make_slider(slide_args);
+			agent& slide = *player;
+			random_placer place(place_args);
+
+			std::unique_lock<std::mutex> guard(lock);
+			episode game = stats.spare();
+			guard.unlock();
+
+			for (size_t index; (index = issue++) < total; ) {
+				slide.notify("episode=" + std::to_string(first + index));
+				place.notify("episode=" + std::to_string(first + index));
+				slide.open_episode("~:" + place.name());
+				place.open_episode(slide.name() + ":~");
+
+				game.open_episode(slide.name() + ":" + place.name());
+				agent& win = play_episode(game, slide, place);
+				game.close_episode(win.name());
+
+				slide.close_episode(win.name());
+				place.close_episode(win.name());
+
+				guard.lock();
+				done.emplace(index, std::move(game));
+				for (auto it = done.begin(); it != done.end() && it->first == stats.step(); it = done.erase(it))
+					stats.push_episode(std::move(it->second));
+				game = stats.spare();
+				guard.unlock();
+			}
+		};
+		std::vector<std::thread> workers;
+		for (size_t id = 0; id < threads; id++) workers.emplace_back(worker);
+		for (std::thread& th : workers) th.join();
+	}
+
 	while (!stats.is_finished()) {
 //		std::cerr << "======== Game " << stats.step() << " ========" << std::endl;
+		slide.notify("episode=" + std::to_string(first + stats.step()));
+		place.notify("episode=" + std::to_string(first + stats.step()));
 		slide.open_episode("~:" + place.name());
 		place.open_episode(slide.name() + ":~");
 
 		stats.open_episode(slide.name() + ":" + place.name());
 		episode& game = stats.back();
-		while (true) {
-			agent& who = game.take_turns(slide, place);
-			action move = who.take_action(game.state());
-//			std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
-			if (game.apply_action(move) != true) break;
-			if (who.check_for_win(game.state())) break;
-		}
-		agent& win = game.last_turns(slide, place);
+		agent& win = play_episode(game, slide, place);
 		stats.close_episode(win.name());
 
 		slide.close_episode(win.name());
@@ -88,8 +215,9 @@ int main(int argc, const char* argv[]) {
 	}
 
 	if (save_path.size()) {
-		std::ofstream out(save_path, std::ios::out | std::ios::trunc);
-		out << stats;
+		bool binary = save_path.size() > 4 && save_path.compare(save_path.size() - 4, 4, ".bin") == 0;
+		std::ofstream out(save_path, std::ios::out | std::ios::trunc | std::ios::binary);
+		stats.save(out, binary);
 		out.close();
 	}
 
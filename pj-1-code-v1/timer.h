@@ -0,0 +1,99 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * timer.h: Clocks for timing the moves at nanosecond resolution
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <string>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * the clock of move timing, which is one of
+ * - steady, the monotonic clock (default)
+ * - tsc, the time stamp counter calibrated against the steady clock, if the machine supports it
+ * - system, the wall clock
+ *
+ * the moves may also be sampled, i.e., only one of every n pairs of moves is timed,
+ * and its time is scaled by n so that the total time is still estimated
+ *
+ * the clock should be configured before any episode begins
+ */
+class timer {
+public:
+	static void use(const std::string& name) {
+		if (name == "steady") config().mode = steady;
+		else if (name == "system") config().mode = system;
+		else if (name == "tsc") config().mode = tsc, calibrate();
+		else throw std::invalid_argument("unknown timer: " + name);
+	}
+	static void sample(unsigned n) { config().every = n ? n : 1; }
+	static unsigned every() { return config().every; }
+
+	/**
+	 * whether the move of the given step is timed
+	 */
+	static bool timed(size_t step) { return config().every == 1 || (step / 2) % config().every == 0; }
+
+	/**
+	 * the current time in nanoseconds, since an unspecified point
+	 */
+	static uint64_t now() {
+		switch (config().mode) {
+		default:
+		case steady: return ticks<std::chrono::steady_clock>();
+		case system: return ticks<std::chrono::system_clock>();
+		case tsc: return uint64_t(counter() * config().scale);
+		}
+	}
+
+	/**
+	 * the current wall-clock time in milliseconds, for the timestamps of episodes
+	 */
+	static uint64_t millisec() {
+		auto now = std::chrono::system_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+	}
+
+private:
+	enum source { steady, tsc, system };
+	struct setting {
+		source mode;
+		unsigned every;
+		double scale; // nanoseconds per tick of tsc
+		setting() : mode(steady), every(1), scale(0) {}
+	};
+	static setting& config() { static setting conf; return conf; }
+
+	template<typename clock>
+	static uint64_t ticks() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	static uint64_t counter() { return __rdtsc(); }
+
+	/**
+	 * measure the tick rate of tsc against the steady clock for about 10 ms
+	 */
+	static void calibrate() {
+		uint64_t t0 = ticks<std::chrono::steady_clock>(), c0 = counter();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		uint64_t t1 = ticks<std::chrono::steady_clock>(), c1 = counter();
+		if (c1 > c0) config().scale = double(t1 - t0) / double(c1 - c0);
+		else config().mode = steady;
+	}
+#else
+	static uint64_t counter() { return 0; }
+	static void calibrate() { config().mode = steady; }
+#endif
+};
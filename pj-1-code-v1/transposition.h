@@ -0,0 +1,224 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * transposition.h: Lock-free transposition table shared by search agents
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <atomic>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <string>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "bitboard.h"
+#include "profile.h"
+
+/**
+ * fixed-size table of search results, keyed on the canonical form of the packed board and its attr,
+ * so that the 8 isomorphisms of a board share one entry
+ * a value is reused only if it was searched with exactly the same depth
+ * an entry of a board before a slide, i.e., a max node, also packs its best slide in the frame of the canonical form,
+ * which is mapped back to the frame of the queried board, e.g., for searching the best slide first
+ *
+ * the table may be accessed by any number of threads without locks: each 16-byte slot stores its data word
+ * and its tiles XORed with the data word, so a slot torn by concurrent writes fails the verification
+ * a bucket has two slots, the first one is replaced only by a search of at least the same depth,
+ * while the second one is always replaced, so a bucket keeps its deepest and its most recent entries
+ *
+ * a table may also be persisted in a file, which is mapped in place, e.g., an opening book shared across runs;
+ * the file begins with a 64-byte header (magic "TCGT":4-byte) (version:4-byte) (tag digest:8-byte) (#bucket:8-byte),
+ * and the file is reinitialized if any of them differs, e.g., if the table is opened for another network
+ */
+class transposition {
+public:
+	transposition(size_t bytes = 16 << 20) : storage(new slot[2 * capacity(bytes) + 1], std::default_delete<slot[]>()), mask(capacity(bytes) - 1) {
+		table = storage.get();
+		if (reinterpret_cast<uintptr_t>(table) % (2 * sizeof(slot))) table++; // align the buckets to 32 bytes
+	}
+	/**
+	 * the table mapped from a file, or an empty table in memory if the file cannot be mapped
+	 */
+	transposition(const std::string& path, size_t bytes, const std::string& tag) : transposition(0) {
+		size_t buckets = capacity(bytes), len = header + buckets * 2 * sizeof(slot);
+		int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd == -1 || ::flock(fd, LOCK_EX) != 0) {
+			std::cerr << "failed to open the table " << path << std::endl;
+			if (fd != -1) ::close(fd);
+			return;
+		}
+		struct stat st;
+		uint64_t head[3] = { (uint64_t(version) << 32) | magic, digest(tag), buckets }, old[3] = {};
+		bool valid = ::fstat(fd, &st) == 0 && size_t(st.st_size) == len && ::pread(fd, old, sizeof(old), 0) == sizeof(old)
+				&& std::memcmp(head, old, sizeof(head)) == 0;
+		if (!valid) {
+			valid = ::ftruncate(fd, 0) == 0 && ::ftruncate(fd, len) == 0 && ::pwrite(fd, head, sizeof(head), 0) == sizeof(head);
+		}
+		void* addr = valid ? ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+		::flock(fd, LOCK_UN);
+		::close(fd);
+		if (addr == MAP_FAILED) {
+			std::cerr << "failed to map the table " << path << std::endl;
+			return;
+		}
+		storage.reset(static_cast<slot*>(addr), [len](slot* p) { ::munmap(p, len); });
+		table = reinterpret_cast<slot*>(static_cast<char*>(addr) + header);
+		mask = buckets - 1;
+	}
+
+	/**
+	 * the table shared by all agents of the same tag, e.g., the agents of the same weights on different threads
+	 * the table is released when none of the agents holds it
+	 */
+	static std::shared_ptr<transposition> shared(size_t bytes, const std::string& tag = "") {
+		std::lock_guard<std::mutex> guard(registry().lock);
+		std::string key = std::to_string(bytes) + ":" + tag;
+		std::shared_ptr<transposition> table = registry().tables[key].lock();
+		if (!table) registry().tables[key] = table = std::make_shared<transposition>(bytes);
+		return table;
+	}
+	/**
+	 * the table persisted in a file, which is shared by all agents opening the same file, and by other processes
+	 */
+	static std::shared_ptr<transposition> persistent(const std::string& path, size_t bytes, const std::string& tag) {
+		std::lock_guard<std::mutex> guard(registry().lock);
+		std::string key = "file:" + path;
+		std::shared_ptr<transposition> table = registry().tables[key].lock();
+		if (!table) registry().tables[key] = table = std::make_shared<transposition>(path, bytes, tag);
+		return table;
+	}
+
+public:
+	bool find(const bitboard& board, unsigned depth, float& value) const {
+		bitboard b = board.canonical();
+		const slot* k = table + 2 * index(b);
+		for (const slot* s = k; s != k + 2; s++) {
+			uint64_t data = s->data.load(std::memory_order_relaxed);
+			uint64_t tile = s->key.load(std::memory_order_relaxed) ^ data;
+			if (tile != b.raw() || (data >> 32) != tag(b, depth)) continue;
+			PROFILE_COUNT(profile::tt_hit, 1);
+			uint32_t bits = uint32_t(data);
+			std::memcpy(&value, &bits, sizeof(value));
+			return true;
+		}
+		PROFILE_COUNT(profile::tt_miss, 1);
+		return false;
+	}
+	/**
+	 * the best slide stored for a board before a slide by a search of any depth, or -1 if there is none
+	 * the slide of the deepest search is taken if both slots of the bucket have one
+	 */
+	int best(const bitboard& board) const {
+		unsigned iso;
+		bitboard b = canonical(board, iso);
+		const slot* k = table + 2 * index(b);
+		unsigned move = none, deepest = 0;
+		for (const slot* s = k; s != k + 2; s++) {
+			uint64_t data = s->data.load(std::memory_order_relaxed);
+			uint64_t tile = s->key.load(std::memory_order_relaxed) ^ data;
+			uint32_t head = data >> 32;
+			if (tile != b.raw() || !(head >> 31) || (head & 0xfffffu) != (b.info() & 0xfffffu)) continue;
+			unsigned op = (head >> 28) & 0x7u, depth = (head >> 20) & 0xffu;
+			if (op == none || (move != none && depth <= deepest)) continue;
+			move = op;
+			deepest = depth;
+		}
+		if (move == none) return -1;
+		return iso >= 4 ? (iso - move) % 4 : (move + 4 - iso) % 4;
+	}
+
+	/**
+	 * store the value of an afterstate, or the value and the best slide (op) of a board before a slide
+	 */
+	void store(const bitboard& board, unsigned depth, float value, int op = -1) {
+		unsigned iso = 0, move = none;
+		bitboard b = op == -1 ? board.canonical() : canonical(board, iso);
+		if (op != -1) move = ((iso >= 4 ? 4 - op : op) + iso) % 4; // the slide in the frame of the canonical form
+		slot* k = table + 2 * index(b);
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		uint64_t data = (uint64_t(tag(b, depth, move)) << 32) | bits;
+		uint64_t prefer = k[0].data.load(std::memory_order_relaxed);
+		bool replace = !(prefer >> 63) || depth >= ((prefer >> 52) & 0xffu);
+		slot& s = k[replace ? 0 : 1];
+		s.key.store(b.raw() ^ data, std::memory_order_relaxed);
+		s.data.store(data, std::memory_order_relaxed);
+	}
+	void clear() {
+		for (slot* s = table; s != table + size(); s++) {
+			s->key.store(0, std::memory_order_relaxed);
+			s->data.store(0, std::memory_order_relaxed);
+		}
+	}
+	size_t size() const { return (mask + 1) * 2; }
+
+private:
+	enum { magic = 0x54474354u, version = 3, header = 64 }; // "TCGT" in little endian
+
+	struct registry_t {
+		std::mutex lock;
+		std::map<std::string, std::weak_ptr<transposition>> tables;
+	};
+	static registry_t& registry() { static registry_t reg; return reg; }
+
+	static uint64_t digest(const std::string& tag) {
+		uint64_t h = 0xcbf29ce484222325ull;
+		for (char ch : tag) h = (h ^ uint8_t(ch)) * 0x100000001b3ull;
+		return h;
+	}
+
+	struct slot {
+		std::atomic<uint64_t> key; // the tiles XORed with the data word
+		std::atomic<uint64_t> data; // (used:1-bit) (slide:3-bit) (depth:8-bit) (board attr:20-bit) (value:32-bit)
+		slot() : key(0), data(0) {}
+	};
+
+	enum { none = 4 }; // the slide of an afterstate, which has no slide to take
+
+	/**
+	 * the upper half of a data word
+	 */
+	static uint32_t tag(const bitboard& b, unsigned depth, unsigned move = none) {
+		return uint32_t(b.info() & 0xfffffu) | (uint32_t(depth & 0xffu) << 20) | (move << 28) | (1u << 31);
+	}
+	/**
+	 * the canonical form of a board, and the isomorphism (iso) which maps the board to it
+	 */
+	static bitboard canonical(const bitboard& board, unsigned& iso) {
+		std::array<bitboard, 8> form;
+		board.isomorphisms(form);
+		iso = 0;
+		for (unsigned k = 1; k < 8; k++) {
+			if (form[k].raw() < form[iso].raw() || (form[k].raw() == form[iso].raw() && form[k].info() < form[iso].info()))
+				iso = k;
+		}
+		return form[iso];
+	}
+	size_t index(const bitboard& b) const {
+		uint64_t h = b.raw() ^ (b.info() * 0x9e3779b97f4a7c15ull);
+		h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+		h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+		return (h ^ (h >> 31)) & mask;
+	}
+	static size_t capacity(size_t bytes) {
+		size_t num = 1;
+		while (num * 4 * sizeof(slot) <= bytes) num *= 2;
+		return num;
+	}
+
+private:
+	std::shared_ptr<slot> storage; // the allocated or mapped memory of the table
+	slot* table; // the buckets of 2 slots, the number of buckets is (mask + 1)
+	size_t mask;
+};
@@ -11,39 +11,93 @@
 #include <iostream>
 #include <vector>
 #include <utility>
+#include <memory>
+#include <cstdint>
+#include <cstring>
 
-class weight {
+/**
+ * brain floating point, i.e., the upper 16 bits of a float, rounded to the nearest even
+ */
+struct bfloat16 {
+	uint16_t bits;
+	bfloat16(float f = 0) {
+		uint32_t u;
+		std::memcpy(&u, &f, sizeof(u));
+		bits = (u + 0x7fffu + ((u >> 16) & 1)) >> 16;
+	}
+	operator float() const {
+		uint32_t u = uint32_t(bits) << 16;
+		float f;
+		std::memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+};
+
+/**
+ * a weight table either owns its values, or views the values stored elsewhere,
+ * e.g., a read-only memory-mapped weight file, or a block shared by all tables of a network,
+ * which is kept alive by 'owner'
+ *
+ * the values are stored as float by default, or in 16 bits as either bfloat16,
+ * or int16_t for fixed-point values whose scale is kept by the network
+ */
+template<typename value_t>
+class basic_weight {
 public:
-	typedef float type;
+	typedef value_t type;
 
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
-	weight(const weight& f) = default;
+	basic_weight() : base(nullptr), length(0) {}
+	basic_weight(size_t len) : value(len), base(value.data()), length(len) {}
+	basic_weight(type* view, size_t len, std::shared_ptr<void> owner) : base(view), length(len), owner(owner) {}
+	basic_weight(basic_weight&& f) : value(std::move(f.value)), base(f.base), length(f.length), owner(std::move(f.owner)) {}
+	basic_weight(const basic_weight& f) : value(f.value), base(f.owner ? f.base : value.data()), length(f.length), owner(f.owner) {}
+
+	basic_weight& operator =(const basic_weight& f) { return operator =(basic_weight(f)); }
+	basic_weight& operator =(basic_weight&& f) {
+		value = std::move(f.value);
+		base = f.base;
+		length = f.length;
+		owner = std::move(f.owner);
+		return *this;
+	}
+	type& operator[] (size_t i) { return base[i]; }
+	const type& operator[] (size_t i) const { return base[i]; }
+	size_t size() const { return length; }
+	bool mapped() const { return owner != nullptr; }
 
-	weight& operator =(const weight& f) = default;
-	type& operator[] (size_t i) { return value[i]; }
-	const type& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	/**
+	 * add u to a value with relaxed atomic accesses, so that the tables can be updated by multiple threads
+	 * without locks, where a concurrent update may be lost but a value is never torn
+	 */
+	void add(size_t i, type u) { add(base + i, u); }
+	static void add(type* w, type u) {
+		type v;
+		__atomic_load(w, &v, __ATOMIC_RELAXED);
+		v += u;
+		__atomic_store(w, &v, __ATOMIC_RELAXED);
+	}
 
 public:
-	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+	friend std::ostream& operator <<(std::ostream& out, const basic_weight& w) {
+		uint64_t size = w.size();
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(type) * size);
+		out.write(reinterpret_cast<const char*>(w.base), sizeof(type) * size);
 		return out;
 	}
-	friend std::istream& operator >>(std::istream& in, weight& w) {
-		auto& value = w.value;
+	friend std::istream& operator >>(std::istream& in, basic_weight& w) {
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-		value.resize(size);
-		in.read(reinterpret_cast<char*>(value.data()), sizeof(type) * size);
+		w = basic_weight(size);
+		in.read(reinterpret_cast<char*>(w.base), sizeof(type) * size);
 		return in;
 	}
 
 protected:
 	std::vector<type> value;
+	type* base;
+	size_t length;
+	std::shared_ptr<void> owner;
 };
+
+typedef basic_weight<float> weight;